@@ -0,0 +1,53 @@
+#!/bin/bash
+# Benchmark on a synthetic cohort. Sizes can be set with environment variables, e.g.
+#   BENCH_N=5000 BENCH_M=1000000 make bench
+
+EXE=${EXE:-$PWD/bgt}
+N=${BENCH_N:-2000}     # number of samples
+M=${BENCH_M:-200000}   # number of sites
+DIR=${BENCH_DIR:-bench}
+
+if [ ! -x $EXE ]; then
+	echo "ERROR: failed to find '$EXE' executable."
+	exit 1
+fi
+mkdir -p $DIR && cd $DIR || exit 1
+
+TIMEFORMAT=%R
+tm() { { time "$@" > /dev/null 2>&1; } 2>&1; } # wall-clock seconds of a command
+report() { awk -v t=$2 -v x=$3 -v u="$4" -v name="$1" 'BEGIN{printf("%-16s %8.3f sec  %10.3f %s\n", name, t, t>0? x/t : 0, u)}'; }
+
+P=sim$N-$M
+if [ ! -f $P.raw.bcf ]; then
+	echo "MESSAGE: simulating $N samples and $M sites..."
+	$EXE simulate -n $N -m $M -p 4 -M 0.005 -S $P.pop.spl -b -l1 > $P.raw.bcf
+fi
+echo "MESSAGE: bgt $($EXE version); $N samples; $M sites"
+G=$(awk -v n=$N -v m=$M 'BEGIN{print n*m/1e6}') # million genotypes in total
+
+t=$(tm $EXE import $P.bgt $P.raw.bcf)
+cp $P.pop.spl $P.bgt.spl
+report import $t $G "Mgt/s"
+cat $P.bgt.pbf $P.bgt.bcf | wc -c | awk '{printf("%-16s %8.3f MB\n", "import-size", $1/1e6)}'
+
+t=$(tm $EXE view -G $P.bgt)
+report scan-sites $t $M "sites/s"
+t=$(tm $EXE view -C $P.bgt)
+report scan-vcf $t $G "Mgt/s"
+t=$(tm $EXE view -t AC,AN $P.bgt)
+report scan-ac $t $G "Mgt/s"
+
+L=$(awk -v m=$M 'BEGIN{print m*100}') # approximate length of the contig; see -d of simulate
+t=$(tm sh -c "for i in 1 2 3 4 5 6 7 8 9 10; do $EXE view -r 1:\$((i*$L/11))-\$((i*$L/11+$L/100)) $P.bgt; done")
+report region $t 10 "queries/s"
+
+t=$(tm $EXE view -s 'population=="P1"' -f 'AC>0' $P.bgt)
+report subset $t $(awk -v g=$G 'BEGIN{print g/4}') "Mgt/s"
+t=$(tm $EXE view -s,S0,S1,S2,S3,S4,S5,S6,S7,S8,S9 -G -C $P.bgt)
+report subset-10 $t $M "sites/s"
+
+$EXE view -G -t CHROM,POS,REF,ALT $P.bgt | awk 'NR%1000==1{print $1":"$2":"length($3)":"$4}' > $P.alleles
+t=$(tm $EXE view -a $P.alleles $P.bgt)
+report allele $t $(wc -l < $P.alleles) "alleles/s"
+t=$(tm $EXE view -a $P.alleles -S $P.bgt)
+report allele-S $t $(wc -l < $P.alleles) "alleles/s"
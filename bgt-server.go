@@ -9,6 +9,12 @@ import (
 	"strings"
 	"path"
 	"time"
+	"sync"
+	"io"
+	"compress/gzip"
+	"crypto/rand"
+	"encoding/hex"
+	"container/list"
 )
 
 /*
@@ -34,13 +40,6 @@ void bgtm_set_file(bgtm_t *bm, int i, const bgt_file_t *f)
 	bm->bgt[i] = bgt_reader_init(f);
 }
 
-char *bgtm_format_bcf1(const bgtm_t *bm, const bcf1_t *v)
-{
-	kstring_t s = {0,0,0};
-	vcf_format1(bm->h_out, v, &s);
-	return s.s;
-}
-
 char *bgtm_hapcnt2str(const bgtm_t *bm)
 {
 	bgt_hapcnt_t *hc;
@@ -125,6 +124,15 @@ var bgt_file_names []string;
 var bgt_port string = "8000";
 var bgt_max_gt uint64 = uint64(10000000);
 var bgt_min_group int = 0;
+var bgt_cache_mb int64 = 256;
+var bgt_pool_size int = 16;
+var bgt_pool chan *C.bgtm_t;
+var bgt_n_threads int = 0; // BGZF read-ahead threads per reader
+var bgt_rcache_mb int64 = 64;
+var bgt_max_est uint64 = 0; // reject queries estimated to read more genotypes; 0 to disable
+var bgt_n_heavy int = 2;
+var bgt_heavy chan bool; // semaphore limiting concurrent expensive queries
+var bgt_heavy_wait = 30 * time.Second;
 
 func bgtm_open(fns []string) ([](*C.bgt_file_t), []string) {
 	files := make([](*C.bgt_file_t), len(fns));
@@ -149,9 +157,409 @@ func bgtm_reader_init(files [](*C.bgt_file_t)) (*C.bgtm_t) {
 	for i := 0; i < len(files); i += 1 {
 		C.bgtm_set_file(bm, C.int(i), files[i]);
 	}
+	C.bgtm_set_threads(bm, C.int(bgt_n_threads));
 	return bm;
 }
 
+func bgtm_reader_get() (*C.bgtm_t) { // take an idle reader from the pool or create a new one
+	select {
+	case bm := <-bgt_pool:
+		return bm;
+	default:
+		return bgtm_reader_init(bgt_files);
+	}
+}
+
+func bgtm_reader_put(bm *C.bgtm_t) { // reset the reader and return it to the pool
+	C.bgtm_reader_reset(bm);
+	select {
+	case bgt_pool <- bm:
+	default: // the pool is full
+		C.bgtm_reader_destroy(bm);
+	}
+}
+
+/****************
+ * Result cache *
+ ****************/
+
+type bgs_rcache_ent struct {
+	key string;
+	mtime int64; // bgs_files_mtime() when the result was generated
+	data []byte;
+}
+
+type bgs_rcache_t struct {
+	sync.Mutex;
+	max_bytes, bytes int64;
+	lru *list.List; // front: most recently used
+	h map[string]*list.Element;
+}
+
+var bgs_rcache = bgs_rcache_t{lru: list.New(), h: make(map[string]*list.Element)};
+
+func bgs_files_mtime() int64 { // combined modification time of all BGT files
+	var t int64 = 0;
+	for _, fn := range bgt_file_names {
+		for _, ext := range []string{".bcf", ".pbf", ".spl"} {
+			if st, err := os.Stat(fn + ext); err == nil {
+				t = t * 31 + st.ModTime().UnixNano();
+			}
+		}
+	}
+	return t;
+}
+
+func bgs_rcache_key(form map[string][]string) string { // normalize query parameters affecting the output
+	key := strings.Join(bgt_file_names, ",");
+	for _, p := range []string{"g", "C", "S", "H"} {
+		if len(form[p]) > 0 {
+			key += "\x00" + p;
+		}
+	}
+	for _, p := range []string{"r", "i", "n", "t", "f", "a", "s"} {
+		if len(form[p]) == 0 {
+			continue;
+		}
+		key += "\x00" + p;
+		for _, v := range form[p] { // the order of 's' matters
+			v = strings.TrimSpace(v);
+			if p == "r" {
+				v = strings.Replace(v, ",", "", -1);
+			} else if p == "f" || p == "a" || p == "s" {
+				v = bgs_replace_op(v);
+			}
+			key += "\x01" + v;
+		}
+	}
+	return key;
+}
+
+func (c *bgs_rcache_t) get(key string, mtime int64) []byte {
+	c.Lock();
+	defer c.Unlock();
+	e, ok := c.h[key];
+	if !ok {
+		return nil;
+	}
+	ent := e.Value.(*bgs_rcache_ent);
+	if ent.mtime != mtime { // BGT files have been changed
+		c.remove(e);
+		return nil;
+	}
+	c.lru.MoveToFront(e);
+	return ent.data;
+}
+
+func (c *bgs_rcache_t) put(key string, mtime int64, data []byte) {
+	c.Lock();
+	defer c.Unlock();
+	if int64(len(data)) > c.max_bytes {
+		return;
+	}
+	if e, ok := c.h[key]; ok {
+		c.remove(e);
+	}
+	for c.bytes + int64(len(data)) > c.max_bytes && c.lru.Len() > 0 {
+		c.remove(c.lru.Back());
+	}
+	c.h[key] = c.lru.PushFront(&bgs_rcache_ent{key, mtime, data});
+	c.bytes += int64(len(data));
+}
+
+func (c *bgs_rcache_t) remove(e *list.Element) { // the lock must be held
+	ent := c.lru.Remove(e).(*bgs_rcache_ent);
+	delete(c.h, ent.key);
+	c.bytes -= int64(len(ent.data));
+}
+
+type bgs_tee_writer struct { // keep a copy of a response for caching
+	http.ResponseWriter;
+	status int;
+	max int64;
+	buf []byte;
+}
+
+func (w *bgs_tee_writer) WriteHeader(status int) {
+	w.status = status;
+	w.ResponseWriter.WriteHeader(status);
+}
+
+func (w *bgs_tee_writer) Write(b []byte) (int, error) {
+	if w.buf != nil && int64(len(w.buf) + len(b)) <= w.max {
+		w.buf = append(w.buf, b...);
+	} else {
+		w.buf = nil; // too large to be cached
+	}
+	return w.ResponseWriter.Write(b);
+}
+
+/***********
+ * Cursors *
+ ***********/
+
+type bgs_cursor_ent struct {
+	bm *C.bgtm_t; // live reader; nil after it expires
+	key string; // bgs_rcache_key() of the query
+	row []C.int64_t; // positions to resume from when the reader is gone
+	voff []C.uint64_t;
+	expire, pos_expire time.Time;
+}
+
+type bgs_cursor_t struct { // positions are kept server side; clients only see random tokens
+	sync.Mutex;
+	max, max_pos int; // max number of live readers and of tokens
+	ttl, pos_ttl time.Duration;
+	n_live int;
+	h map[string]*bgs_cursor_ent;
+}
+
+var bgs_cursors = bgs_cursor_t{max: 64, max_pos: 1<<16, ttl: 60 * time.Second, pos_ttl: time.Hour, h: make(map[string]*bgs_cursor_ent)};
+
+func (c *bgs_cursor_t) drop_reader(e *bgs_cursor_ent) { // the lock must be held
+	if e.bm != nil {
+		bgtm_reader_put(e.bm);
+		e.bm = nil;
+		c.n_live -= 1;
+	}
+}
+
+func (c *bgs_cursor_t) sweep() { // return expired readers to the pool and forget expired tokens; the lock must be held
+	now := time.Now();
+	for id, e := range c.h {
+		if now.After(e.expire) {
+			c.drop_reader(e);
+		}
+		if now.After(e.pos_expire) {
+			delete(c.h, id);
+		}
+	}
+	for id, e := range c.h { // drop arbitrary readers and tokens if there are too many
+		if c.n_live < c.max && len(c.h) < c.max_pos {
+			break;
+		}
+		c.drop_reader(e);
+		if len(c.h) >= c.max_pos {
+			delete(c.h, id);
+		}
+	}
+}
+
+func (c *bgs_cursor_t) keep(bm *C.bgtm_t, key string) string { // keep a reader alive and return a token of its position
+	n := int(bm.n_bgt);
+	e := &bgs_cursor_ent{bm: bm, key: key, row: make([]C.int64_t, n), voff: make([]C.uint64_t, n)};
+	C.bgtm_get_cursor(bm, &e.row[0], &e.voff[0]);
+	id := make([]byte, 16);
+	if _, err := rand.Read(id); err != nil {
+		panic(err);
+	}
+	token := hex.EncodeToString(id);
+	now := time.Now();
+	e.expire, e.pos_expire = now.Add(c.ttl), now.Add(c.pos_ttl);
+	c.Lock();
+	defer c.Unlock();
+	c.sweep();
+	c.h[token] = e;
+	c.n_live += 1;
+	return token;
+}
+
+func (c *bgs_cursor_t) take(token string, key string) (*C.bgtm_t, *bgs_cursor_ent) { // get the live reader, if any, and positions of a token
+	c.Lock();
+	defer c.Unlock();
+	e, ok := c.h[token];
+	if !ok || e.key != key || time.Now().After(e.pos_expire) { // unknown, for a different query or expired
+		return nil, nil;
+	}
+	bm := e.bm;
+	if bm != nil {
+		e.bm = nil; // the positions stay such that the same page can be requested again
+		c.n_live -= 1;
+		if time.Now().After(e.expire) {
+			bgtm_reader_put(bm);
+			bm = nil;
+		}
+	}
+	return bm, e;
+}
+
+/***********
+ * Metrics *
+ ***********/
+
+var bgs_lat_bounds = []float64{0.001, 0.005, 0.01, 0.05, 0.1, 0.5, 1, 5, 10, 60}; // upper bounds of latency buckets, in seconds
+
+type bgs_hist_t struct {
+	cnt []uint64; // cnt[i]: number of requests in (bgs_lat_bounds[i-1],bgs_lat_bounds[i]]; the last for +Inf
+	sum float64;
+	n uint64;
+}
+
+type bgs_metrics_t struct {
+	sync.Mutex;
+	start time.Time;
+	lat map[string]*bgs_hist_t; // latency per query shape
+	n_req map[string]uint64; // number of requests per shape and status code
+	n_gt, n_site_read, n_site_out, n_bytes uint64;
+	st_t, st_n []uint64; // per-stage ticks and events; see BGT_ST_* in bgt.h
+	n_row_dec, n_row_replay, n_ckpt uint64;
+	n_rc_hit, n_rc_miss uint64; // result cache
+}
+
+var bgs_metrics = bgs_metrics_t{start: time.Now(), lat: make(map[string]*bgs_hist_t), n_req: make(map[string]uint64),
+	st_t: make([]uint64, C.BGT_N_ST), st_n: make([]uint64, C.BGT_N_ST)};
+var bgs_stage_names = []string{"bcf", "pbf_seek", "pbf_decode", "info", "filter", "genotypes", "format"};
+
+func bgs_query_shape(form map[string][]string) string { // classify a query for the metrics
+	if len(form["a"]) > 0 {
+		return "allele";
+	} else if len(form["r"]) > 0 {
+		return "region";
+	} else if len(form["t"]) > 0 || len(form["S"]) > 0 || len(form["H"]) > 0 {
+		return "table";
+	}
+	return "vcf";
+}
+
+func (m *bgs_metrics_t) add_query(shape string, status int, t float64, bytes uint64) {
+	m.Lock();
+	defer m.Unlock();
+	h, ok := m.lat[shape];
+	if !ok {
+		h = &bgs_hist_t{cnt: make([]uint64, len(bgs_lat_bounds) + 1)};
+		m.lat[shape] = h;
+	}
+	i := 0;
+	for i < len(bgs_lat_bounds) && t > bgs_lat_bounds[i] {
+		i += 1;
+	}
+	h.cnt[i] += 1;
+	h.sum += t;
+	h.n += 1;
+	m.n_req[fmt.Sprintf("shape=\"%s\",code=\"%d\"", shape, status)] += 1;
+	m.n_bytes += bytes;
+}
+
+func (m *bgs_metrics_t) add_reader(bm *C.bgtm_t) { // counters from C
+	var st C.bgt_stats_t;
+	C.bgtm_get_stats(bm, &st);
+	m.Lock();
+	m.n_gt += uint64(st.n_gt_read);
+	m.n_site_read += uint64(st.n_site_read);
+	m.n_site_out += uint64(st.n_site_out);
+	for i := 0; i < len(m.st_t); i += 1 {
+		m.st_t[i] += uint64(st.t[i]);
+		m.st_n[i] += uint64(st.n[i]);
+	}
+	m.n_row_dec += uint64(st.n_row_dec);
+	m.n_row_replay += uint64(st.n_row_replay);
+	m.n_ckpt += uint64(st.n_ckpt);
+	m.Unlock();
+}
+
+func (m *bgs_metrics_t) add_rcache(hit bool) {
+	m.Lock();
+	if hit {
+		m.n_rc_hit += 1;
+	} else {
+		m.n_rc_miss += 1;
+	}
+	m.Unlock();
+}
+
+type bgs_count_writer struct { // count bytes and keep the status code of a response
+	http.ResponseWriter;
+	status int;
+	n uint64;
+}
+
+func (w *bgs_count_writer) WriteHeader(status int) {
+	w.status = status;
+	w.ResponseWriter.WriteHeader(status);
+}
+
+func (w *bgs_count_writer) Write(b []byte) (int, error) {
+	n, err := w.ResponseWriter.Write(b);
+	w.n += uint64(n);
+	return n, err;
+}
+
+func bgs_metrics_print(w http.ResponseWriter, r *http.Request) { // in the Prometheus text format
+	var bc_hit, bc_miss, bc_bytes C.int64_t;
+	C.bgzf_cache_stat(&bc_hit, &bc_miss, &bc_bytes);
+	bgs_cursors.Lock();
+	n_live := bgs_cursors.n_live;
+	bgs_cursors.Unlock();
+	bgs_rcache.Lock();
+	rc_bytes := bgs_rcache.bytes;
+	bgs_rcache.Unlock();
+
+	m := &bgs_metrics;
+	m.Lock();
+	defer m.Unlock();
+	w.Header().Set("Content-Type", "text/plain; version=0.0.4");
+	p := func(name, typ, help string) {
+		fmt.Fprintf(w, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, typ);
+	};
+	p("bgt_request_duration_seconds", "histogram", "Latency of queries by shape (allele, region, table or vcf).");
+	for shape, h := range m.lat {
+		var acc uint64 = 0;
+		for i, b := range bgs_lat_bounds {
+			acc += h.cnt[i];
+			fmt.Fprintf(w, "bgt_request_duration_seconds_bucket{shape=\"%s\",le=\"%g\"} %d\n", shape, b, acc);
+		}
+		fmt.Fprintf(w, "bgt_request_duration_seconds_bucket{shape=\"%s\",le=\"+Inf\"} %d\n", shape, h.n);
+		fmt.Fprintf(w, "bgt_request_duration_seconds_sum{shape=\"%s\"} %g\n", shape, h.sum);
+		fmt.Fprintf(w, "bgt_request_duration_seconds_count{shape=\"%s\"} %d\n", shape, h.n);
+	}
+	p("bgt_requests_total", "counter", "Number of queries by shape and HTTP status code.");
+	for k, v := range m.n_req {
+		fmt.Fprintf(w, "bgt_requests_total{%s} %d\n", k, v);
+	}
+	p("bgt_genotypes_decoded_total", "counter", "Number of genotypes decoded from PBF.");
+	fmt.Fprintf(w, "bgt_genotypes_decoded_total %d\n", m.n_gt);
+	p("bgt_genotypes_decoded_per_second", "gauge", "Genotypes decoded per second averaged since the server started.");
+	fmt.Fprintf(w, "bgt_genotypes_decoded_per_second %g\n", float64(m.n_gt) / time.Since(m.start).Seconds());
+	p("bgt_sites_read_total", "counter", "Number of sites merged from BGT files.");
+	fmt.Fprintf(w, "bgt_sites_read_total %d\n", m.n_site_read);
+	p("bgt_sites_returned_total", "counter", "Number of sites passing filters.");
+	fmt.Fprintf(w, "bgt_sites_returned_total %d\n", m.n_site_out);
+	p("bgt_stage_ticks_total", "counter", "Ticks (CPU cycles on x86) spent in each stage of reading.");
+	for i, s := range bgs_stage_names {
+		fmt.Fprintf(w, "bgt_stage_ticks_total{stage=\"%s\"} %d\n", s, m.st_t[i]);
+	}
+	p("bgt_stage_events_total", "counter", "Number of times each stage of reading is entered.");
+	for i, s := range bgs_stage_names {
+		fmt.Fprintf(w, "bgt_stage_events_total{stage=\"%s\"} %d\n", s, m.st_n[i]);
+	}
+	p("bgt_pbf_rows_decoded_total", "counter", "Number of PBF rows decoded, including rows replayed.");
+	fmt.Fprintf(w, "bgt_pbf_rows_decoded_total %d\n", m.n_row_dec);
+	p("bgt_pbf_rows_replayed_total", "counter", "Number of PBF rows decoded only to reach a requested row.");
+	fmt.Fprintf(w, "bgt_pbf_rows_replayed_total %d\n", m.n_row_replay);
+	p("bgt_pbf_checkpoints_total", "counter", "Number of PBF checkpoints loaded.");
+	fmt.Fprintf(w, "bgt_pbf_checkpoints_total %d\n", m.n_ckpt);
+	p("bgt_response_bytes_total", "counter", "Number of bytes written to clients.");
+	fmt.Fprintf(w, "bgt_response_bytes_total %d\n", m.n_bytes);
+	p("bgt_reader_pool_idle", "gauge", "Number of idle readers in the pool.");
+	fmt.Fprintf(w, "bgt_reader_pool_idle %d\n", len(bgt_pool));
+	p("bgt_reader_pool_capacity", "gauge", "Max number of idle readers in the pool.");
+	fmt.Fprintf(w, "bgt_reader_pool_capacity %d\n", cap(bgt_pool));
+	p("bgt_cursor_readers", "gauge", "Number of readers kept alive for pagination.");
+	fmt.Fprintf(w, "bgt_cursor_readers %d\n", n_live);
+	p("bgt_block_cache_hits_total", "counter", "Number of BGZF blocks served from the block cache.");
+	fmt.Fprintf(w, "bgt_block_cache_hits_total %d\n", int64(bc_hit));
+	p("bgt_block_cache_misses_total", "counter", "Number of BGZF blocks inflated while the block cache is enabled.");
+	fmt.Fprintf(w, "bgt_block_cache_misses_total %d\n", int64(bc_miss));
+	p("bgt_block_cache_bytes", "gauge", "Size of uncompressed data in the block cache.");
+	fmt.Fprintf(w, "bgt_block_cache_bytes %d\n", int64(bc_bytes));
+	p("bgt_result_cache_hits_total", "counter", "Number of queries answered from the result cache.");
+	fmt.Fprintf(w, "bgt_result_cache_hits_total %d\n", m.n_rc_hit);
+	p("bgt_result_cache_misses_total", "counter", "Number of queries not found in the result cache.");
+	fmt.Fprintf(w, "bgt_result_cache_misses_total %d\n", m.n_rc_miss);
+	p("bgt_result_cache_bytes", "gauge", "Size of results in the result cache.");
+	fmt.Fprintf(w, "bgt_result_cache_bytes %d\n", rc_bytes);
+}
+
 /************
  * Handlers *
  ************/
@@ -184,6 +592,8 @@ func bgs_help(w http.ResponseWriter, r *http.Request) {
 	fmt.Fprintf(w,  "   curl -s 'http://%s/?t=CHROM,POS,END,REF,ALT,AC/AN&f=(AN>0)&r=11:200,000-300,000'\n\n", r.Host);
 	fmt.Fprintln(w, " * Samples in FIN that have three specified alleles:\n");
 	fmt.Fprintf(w,  "   curl -s 'http://%s/?a=,11:151344:1:G,11:110992:AACTT:A,11:160513::G&S&s=(population==\"FIN\")'\n\n", r.Host);
+	fmt.Fprintln(w, " * Server metrics in the Prometheus text format:\n");
+	fmt.Fprintf(w,  "   curl -s 'http://%s/metrics'\n\n", r.Host);
 	fmt.Fprintln(w, "Accepted Parameters");
 	fmt.Fprintln(w, "===================\n");
 	fmt.Fprintln(w, "Sample selection parameter:\n");
@@ -194,6 +604,9 @@ func bgs_help(w http.ResponseWriter, r *http.Request) {
 	fmt.Fprintln(w, "  r STR   Region in a format like '11:200,000-300,000'\n");
 	fmt.Fprintln(w, "  i INT   Start from the i-th record; INT>0\n");
 	fmt.Fprintln(w, "  n INT   Read at most INT records\n");
+	fmt.Fprintln(w, "  c STR   Paginate with a cursor. With 'c' (empty for the first page), a truncated output ends with");
+	fmt.Fprintln(w, "          '*' followed by a TAB and a token; repeat the query with 'c' set to the token for the next");
+	fmt.Fprintln(w, "          page. A token is valid for an hour. Not applicable to 'S' or 'H'.\n");
 	fmt.Fprintln(w, "  a EXPR  List of alleles in a format similar to parameter 's'. An allele is specified by");
 	fmt.Fprintln(w, "          chr:1basedPos:refLen:alleleSeq. Conditions may not work unless the server is launched with");
 	fmt.Fprintln(w, "          a variant annotation database.\n");
@@ -217,6 +630,74 @@ func bgs_replace_op(t string) string {
 	return s;
 }
 
+func bgs_setup(w http.ResponseWriter, form map[string][]string, bm *C.bgtm_t) bool { // set up a reader for a query; return false on errors
+	if len(form["f"]) > 0 { // set site filter
+		cstr := C.CString(bgs_replace_op(form["f"][0]));
+		ret := int(C.bgtm_set_flt_site(bm, cstr));
+		C.free(unsafe.Pointer(cstr));
+		if ret != 0 {
+			http.Error(w, "400 Bad Request: failed to parse parameter 'f'", 400);
+			return false;
+		}
+	}
+	if len(form["r"]) > 0 { // set region
+		cstr := C.CString(form["r"][0]);
+		ret := int(C.bgtm_set_region(bm, cstr));
+		C.free(unsafe.Pointer(cstr));
+		if ret < 0 {
+			http.Error(w, "400 Bad Request: failed to set region with parameter 'r'", 400);
+			return false;
+		}
+	}
+	if len(form["i"]) > 0 { // set start
+		i, _ := strconv.Atoi(form["i"][0]);
+		if i < 1 {
+			http.Error(w, "400 Bad Request: failed to set start with parameter 'i'", 400);
+			return false;
+		}
+		C.bgtm_set_start(bm, C.int64_t(i));
+	}
+	if len(form["t"]) > 0 { // tabular output
+		cstr := C.CString(form["t"][0]);
+		ret := int(C.bgtm_set_table(bm, cstr));
+		C.free(unsafe.Pointer(cstr));
+		if ret < 0 {
+			http.Error(w, "400 Bad Request: failed to parse tabular format with parameter 't'", 400);
+			return false;
+		}
+	}
+	if len(form["a"]) > 0 { // set alleles
+		cstr := C.CString(bgs_replace_op(form["a"][0]));
+		n_al := int(C.bgtm_set_alleles(bm, cstr, bgt_vardb, nil));
+		C.free(unsafe.Pointer(cstr));
+		if n_al <= 0 {
+			if n_al < 0 {
+				http.Error(w, "400 Bad Request: failed to retrieve alleles with parameter 'a'", 400);
+			} else {
+				http.Error(w, "204 No Content: no alleles matching parameter 'a'", 204);
+			}
+			return false;
+		}
+	}
+	if len(form["s"]) > 0 { // set sample groups
+		for _, s := range form["s"] {
+			cstr := C.CString(bgs_replace_op(s));
+			ret := int(C.bgtm_add_group(bm, cstr));
+			C.free(unsafe.Pointer(cstr));
+			if ret < 0 {
+				http.Error(w, "400 Bad Request: failed to set sample group with parameter 's'", 400);
+				return false;
+			}
+		}
+	}
+	C.bgtm_prepare(bm);
+	if int(C.bgtm_test_mgs(bm)) == 0 {
+		http.Error(w, "403 Forbidden: genotype summary can't be computed for small sample groups", 403);
+		return false;
+	}
+	return true;
+}
+
 func bgs_query(w http.ResponseWriter, r *http.Request) {
 	r.URL.RawQuery = strings.Replace(r.URL.RawQuery, "&&", ".AND.", -1);
 	r.ParseForm();
@@ -227,12 +708,41 @@ func bgs_query(w http.ResponseWriter, r *http.Request) {
 		bgs_help(w, r);
 		return;
 	}
-	flag := 2; // BGT_F_NO_GT
+	cw := &bgs_count_writer{ResponseWriter: w, status: 200};
+	w = cw;
+	defer func() {
+		t := float64(time.Now().UnixNano() - start_time) * 1e-9;
+		bgs_metrics.add_query(bgs_query_shape(r.Form), cw.status, t, cw.n);
+	}();
+	flag := 2 | 16; // BGT_F_NO_GT | BGT_F_STATS
 	max_read := 2147483647;
 	vcf_out := true;
-	bm := bgtm_reader_init(bgt_files);
-	defer C.bgtm_reader_destroy(bm);
-	C.bgtm_set_mgs(bm, C.int(bgt_min_group));
+	var n_gt_read uint64 = 0;
+	use_gz := strings.Contains(r.Header.Get("Accept-Encoding"), "gzip");
+
+	if bgs_rcache.max_bytes > 0 && len(r.Form["c"]) == 0 { // look up the result cache
+		key := bgs_rcache_key(r.Form);
+		if use_gz {
+			key += "\x00gzip";
+		}
+		mtime := bgs_files_mtime();
+		data := bgs_rcache.get(key, mtime);
+		bgs_metrics.add_rcache(data != nil);
+		if data != nil {
+			if use_gz {
+				w.Header().Set("Content-Encoding", "gzip");
+			}
+			w.Write(data);
+			return;
+		}
+		tw := &bgs_tee_writer{ResponseWriter: w, status: 200, max: bgs_rcache.max_bytes / 8, buf: make([]byte, 0, 4096)};
+		w = tw;
+		defer func() { // only cache complete results of expensive queries
+			if tw.status == 200 && tw.buf != nil && n_gt_read >= bgt_max_gt / 100 {
+				bgs_rcache.put(key, mtime, tw.buf);
+			}
+		}();
+	}
 
 	{ // set flag
 		if len(r.Form["g"]) > 0 {
@@ -247,108 +757,97 @@ func bgs_query(w http.ResponseWriter, r *http.Request) {
 		if len(r.Form["H"]) > 0 {
 			flag |= 8; // BGT_F_CNT_HAP
 	  	}
-		C.bgtm_set_flag(bm, C.int(flag));
 		if (flag & 12) != 0 {
 			vcf_out = false;
 		}
 	}
-	if len(r.Form["f"]) > 0 { // set site filter
-		cstr := C.CString(bgs_replace_op(r.Form["f"][0]));
-		ret := int(C.bgtm_set_flt_site(bm, cstr));
-		C.free(unsafe.Pointer(cstr));
-		if ret != 0 {
-			http.Error(w, "400 Bad Request: failed to parse parameter 'f'", 400);
+	cursor := len(r.Form["c"]) > 0 && (flag & 12) == 0; // not supported when counting haplotypes or alleles
+	qkey := bgs_rcache_key(r.Form);
+	bm := (*C.bgtm_t)(nil);
+	pos := (*bgs_cursor_ent)(nil);
+	if cursor && r.Form["c"][0] != "" {
+		if bm, pos = bgs_cursors.take(r.Form["c"][0], qkey); pos == nil {
+			http.Error(w, "400 Bad Request: unknown or expired cursor in parameter 'c'", 400);
 			return;
 		}
 	}
-	if len(r.Form["r"]) > 0 { // set region
-		cstr := C.CString(r.Form["r"][0]);
-		ret := int(C.bgtm_set_region(bm, cstr));
-		C.free(unsafe.Pointer(cstr));
-		if ret < 0 {
-			http.Error(w, "400 Bad Request: failed to set region with parameter 'r'", 400);
-			return;
-		}
+	live := (bm != nil);
+	if !live {
+		bm = bgtm_reader_get();
 	}
-	if len(r.Form["i"]) > 0 { // set start
-		i, _ := strconv.Atoi(r.Form["i"][0]);
-		if i < 1 {
-			http.Error(w, "400 Bad Request: failed to set start with parameter 'i'", 400);
-			return;
+	keep := false; // keep the reader alive for the next page
+	defer func() {
+		if !keep {
+			bgtm_reader_put(bm);
 		}
-		C.bgtm_set_start(bm, C.int64_t(i));
-	}
+	}();
+	defer func() { // before bm is reset
+		n_gt_read = uint64(bm.n_gt_read);
+		bgs_metrics.add_reader(bm);
+	}();
+
 	if len(r.Form["n"]) > 0 { // set max number of records to read
 		max_read, _ = strconv.Atoi(r.Form["n"][0]);
 	}
 	if len(r.Form["t"]) > 0 { // tabular output
-		cstr := C.CString(r.Form["t"][0]);
-		ret := int(C.bgtm_set_table(bm, cstr));
-		C.free(unsafe.Pointer(cstr));
 		vcf_out = false;
-		if ret < 0 {
-			http.Error(w, "400 Bad Request: failed to parse tabular format with parameter 't'", 400);
+	}
+	if live { // continue from where the previous page stopped
+		bm.n_rec, bm.n_gt_read, bm.n_site_read, bm.n_site_out = 0, 0, 0, 0;
+		bm.st = C.bgt_stats_t{};
+	} else {
+		C.bgtm_set_mgs(bm, C.int(bgt_min_group));
+		C.bgtm_set_flag(bm, C.int(flag));
+		if !bgs_setup(w, r.Form, bm) {
 			return;
 		}
-	}
-	if len(r.Form["a"]) > 0 { // set alleles
-		cstr := C.CString(bgs_replace_op(r.Form["a"][0]));
-		n_al := int(C.bgtm_set_alleles(bm, cstr, bgt_vardb, nil));
-		C.free(unsafe.Pointer(cstr));
-		if n_al <= 0 {
-			if n_al < 0 {
-				http.Error(w, "400 Bad Request: failed to retrieve alleles with parameter 'a'", 400);
-			} else {
-				http.Error(w, "204 No Content: no alleles matching parameter 'a'", 204);
-			}
+		if pos != nil && int(C.bgtm_set_cursor(bm, &pos.row[0], &pos.voff[0])) != 0 {
+			http.Error(w, "400 Bad Request: failed to resume from parameter 'c'", 400);
 			return;
 		}
 	}
-	if len(r.Form["s"]) > 0 { // set sample groups
-		for _, s := range r.Form["s"] {
-			cstr := C.CString(bgs_replace_op(s));
-			ret := int(C.bgtm_add_group(bm, cstr));
-			C.free(unsafe.Pointer(cstr));
-			if ret < 0 {
-				http.Error(w, "400 Bad Request: failed to set sample group with parameter 's'", 400);
-				return;
-			}
+
+	// admission control
+	est := uint64(C.bgtm_estimate(bm, C.int64_t(max_read)));
+	if bgt_max_est > 0 && est > bgt_max_est {
+		http.Error(w, fmt.Sprintf("403 Forbidden: the query is estimated to read %d genotypes, more than %d allowed", est, bgt_max_est), 403);
+		return;
+	}
+	if est > bgt_max_gt / 10 { // an expensive query; wait for a slot
+		select {
+		case bgt_heavy <- true:
+			defer func() { <-bgt_heavy }();
+		case <-time.After(bgt_heavy_wait):
+			http.Error(w, "503 Service Unavailable: too many expensive queries; please retry later", 503);
+			return;
 		}
 	}
-	C.bgtm_prepare(bm);
-	if int(C.bgtm_test_mgs(bm)) == 0 {
-		http.Error(w, "403 Forbidden: genotype summary can't be computed for small sample groups", 403);
-		return;
+
+	// compress the output if the client accepts gzip
+	var out io.Writer = w;
+	if use_gz {
+		w.Header().Set("Content-Encoding", "gzip");
+		gz, _ := gzip.NewWriterLevel(w, gzip.BestSpeed);
+		defer gz.Close();
+		out = gz;
 	}
 
 	// print header if necessary
 	if vcf_out {
 		gstr := C.GoString(bm.h_out.text);
-		fmt.Fprintln(w, gstr);
+		fmt.Fprintln(out, gstr);
 	}
 
-	// read through
+	// read through; records are formatted in C in batches
 	b := C.bcf_init1();
 	defer C.bcf_destroy1(b);
-	n_read := 0;
+	buf := make([]byte, 1<<16);
 	for {
-		if n_read > max_read || uint64(bm.n_gt_read) > bgt_max_gt {
+		n := int(C.bgtm_read_fmt(bm, b, C.int64_t(max_read), C.uint64_t(bgt_max_gt), (*C.char)(unsafe.Pointer(&buf[0])), C.int(len(buf))));
+		if n <= 0 {
 			break;
 		}
-		ret := int(C.bgtm_read(bm, b));
-		if ret < 0 {
-			break;
-		}
-		if vcf_out {
-			s := C.bgtm_format_bcf1(bm, b);
-			gstr := C.GoString(s);
-			fmt.Fprintln(w, gstr);
-			C.free(unsafe.Pointer(s));
-		} else if int(bm.n_fields) > 0 {
-			gstr := C.GoString(bm.tbl_line.s);
-			fmt.Fprintln(w, gstr);
-		}
-		n_read += 1;
+		out.Write(buf[:n]);
 	}
 
 	// print hapcnt and/or sample list
@@ -356,19 +855,24 @@ func bgs_query(w http.ResponseWriter, r *http.Request) {
 		if (flag & 8) != 0 {
 			s := C.bgtm_hapcnt2str(bm);
 			gstr := C.GoString(s);
-			fmt.Fprint(w, gstr);
+			fmt.Fprint(out, gstr);
 			C.free(unsafe.Pointer(s));
 		}
 		if (flag & 4) != 0 {
 			s := C.bgtm_alcnt_print(bm);
 			gstr := C.GoString(s);
-			fmt.Fprint(w, gstr);
+			fmt.Fprint(out, gstr);
 			C.free(unsafe.Pointer(s));
 		}
 	}
 
-	if n_read > max_read || uint64(bm.n_gt_read) > bgt_max_gt {
-		fmt.Fprintln(w, "*");
+	if int64(bm.n_rec) > int64(max_read) || uint64(bm.n_gt_read) > bgt_max_gt {
+		if cursor { // print the token to the next page
+			fmt.Fprintf(out, "*\t%s\n", bgs_cursors.keep(bm, qkey));
+			keep = true;
+		} else {
+			fmt.Fprintln(out, "*");
+		}
 	}
 }
 
@@ -390,7 +894,7 @@ func main() {
 	}
 	// parse command line options
 	for {
-		opt, arg := getopt(os.Args, "d:p:m:g:");
+		opt, arg := getopt(os.Args, "d:p:m:g:c:k:R:e:j:@:");
 		if opt == 'p' {
 			bgt_port = arg;
 		} else if opt == 'm' {
@@ -401,6 +905,18 @@ func main() {
 			C.free(unsafe.Pointer(cstr));
 		} else if opt == 'g' {
 			bgt_min_group, _ = strconv.Atoi(arg);
+		} else if opt == 'c' {
+			bgt_cache_mb, _ = strconv.ParseInt(arg, 10, 64);
+		} else if opt == 'e' {
+			bgt_max_est, _ = strconv.ParseUint(arg, 10, 64);
+		} else if opt == 'j' {
+			bgt_n_heavy, _ = strconv.Atoi(arg);
+		} else if opt == 'R' {
+			bgt_rcache_mb, _ = strconv.ParseInt(arg, 10, 64);
+		} else if opt == 'k' {
+			bgt_pool_size, _ = strconv.Atoi(arg);
+		} else if opt == '@' {
+			bgt_n_threads, _ = strconv.Atoi(arg);
 		} else if opt < 0 {
 			break;
 		}
@@ -410,18 +926,41 @@ func main() {
 		fmt.Fprintln(os.Stderr, "Options:");
 		fmt.Fprintf(os.Stderr, "  -p INT    port number [%s or from $PORT env]\n", bgt_port);
 		fmt.Fprintf(os.Stderr, "  -m INT    maximal genotypes processed per query [%d]\n", bgt_max_gt);
+		fmt.Fprintf(os.Stderr, "  -e INT    reject queries estimated to read more genotypes (0 for no limit) [%d]\n", bgt_max_est);
+		fmt.Fprintf(os.Stderr, "  -j INT    number of concurrent queries estimated to read >10%% of -m genotypes [%d]\n", bgt_n_heavy);
 		fmt.Fprintf(os.Stderr, "  -d FILE   variant annotations in the FMF format []\n");
 		fmt.Fprintf(os.Stderr, "  -g INT    minimal sample group size (force -G if positive) [0]\n");
+		fmt.Fprintf(os.Stderr, "  -c INT    size of the BGZF block cache shared by all queries, in MB [%d]\n", bgt_cache_mb);
+		fmt.Fprintf(os.Stderr, "  -k INT    number of idle readers kept for reuse [%d]\n", bgt_pool_size);
+		fmt.Fprintf(os.Stderr, "  -@ INT    threads for reading ahead the BCF, per reader [%d]\n", bgt_n_threads);
+		fmt.Fprintf(os.Stderr, "  -R INT    size of the cache of query results, in MB [%d]\n", bgt_rcache_mb);
 		os.Exit(1);
 	}
 
 	C.bgt_no_file = 1;
+	C.bgzf_set_cache_size(nil, C.int64_t(bgt_cache_mb << 20));
 	bgt_files, bgt_prefix = bgtm_open(os.Args[optind:]);
 	defer bgtm_close(bgt_files);
+	bgt_pool = make(chan *C.bgtm_t, bgt_pool_size);
+	if bgt_n_heavy < 1 {
+		bgt_n_heavy = 1;
+	}
+	bgt_heavy = make(chan bool, bgt_n_heavy);
+	bgt_file_names = os.Args[optind:];
+	bgs_rcache.max_bytes = bgt_rcache_mb << 20;
+	if bgt_vardb != nil { // load the annotation join index if present
+		for i := 0; i < len(bgt_files); i += 1 {
+			C.bgt_jdx_load(bgt_files[i]);
+		}
+	}
+	for i := 0; i < len(bgt_files); i += 1 { // load the sample index if present
+		C.bgt_sdx_load(bgt_files[i]);
+	}
 
 	fmt.Fprintf(os.Stderr, "[%d] launched at port %s\n", time.Now().UnixNano(), bgt_port);
 	defer fmt.Fprintf(os.Stderr, "[%d] exited\n", time.Now().UnixNano()); // currently, these are not executed
 
 	http.HandleFunc("/", bgs_query);
+	http.HandleFunc("/metrics", bgs_metrics_print);
 	http.ListenAndServe(fmt.Sprintf(":%s", bgt_port), nil);
 }
@@ -3,6 +3,7 @@
 #include <assert.h>
 #include <limits.h>
 #include <ctype.h>
+#include <time.h>
 #include "bgt.h"
 #include "kstring.h"
 #include "fmf.h"
@@ -13,6 +14,19 @@ KHASH_SET_INIT_STR(str)
 
 int bgt_no_file = 0;
 
+uint64_t bgt_tick(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	uint32_t lo, hi;
+	__asm__ __volatile__ ("rdtsc" : "=a"(lo), "=d"(hi));
+	return (uint64_t)hi << 32 | lo;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
 void *bed_read(const char *fn);
 int bed_overlap(const void *_h, const char *chr, int beg, int end);
 void bed_destroy(void *_h);
@@ -56,6 +70,8 @@ bgt_file_t *bgt_open(const char *prefix)
 	bf->f = fmf_read(fn);
 	if (bf->f == 0) goto bgt_open_err;
 	bf->prefix = strdup(prefix);
+	sprintf(fn, "%s.pbf", prefix);
+	bf->pb = pbf_open_r(fn);
 	bgzf_close(fp);
 	free(fn);
 	bf->mgs = (int32_t*)calloc(bf->f->n_rows, 4);
@@ -72,6 +88,9 @@ bgt_open_err:
 void bgt_close(bgt_file_t *bf)
 {
 	if (bf == 0) return;
+	bgt_jdx_destroy(bf->jdx);
+	bgt_sdx_destroy(bf->sdx);
+	pbf_close(bf->pb);
 	free(bf->mgs);
 	if (bf->idx) hts_idx_destroy(bf->idx);
 	if (bf->h0) bcf_hdr_destroy(bf->h0);
@@ -80,6 +99,350 @@ void bgt_close(bgt_file_t *bf)
 	free(bf);
 }
 
+/*************************
+ * Annotation join index *
+ *************************/
+
+#include "ksort.h"
+#define bgt_key64(x) (x)
+KRADIX_SORT_INIT(64, uint64_t, bgt_key64, 8)
+
+static int bgt_get_row(const bcf_hdr_t *h0, bcf1_t *b) // -1 if _row is absent
+{
+	int i, id, row = -1;
+	id = bcf_id2int(h0, BCF_DT_ID, "_row");
+	assert(id > 0);
+	bcf_unpack(b, BCF_UN_INFO);
+	for (i = 0; i < b->n_info; ++i) {
+		bcf_info_t *p = &b->d.info[i];
+		if (p->key == id) row = p->v1.i;
+	}
+	return row;
+}
+
+/* An index is stale if the BGT it was built from has been replaced. A BGT is
+ * identified by the number of rows, and the size and CRC32 of the last 64kB
+ * of the .bcf and of the .pbf. */
+
+static void bgt_file_id(const char *fn, uint64_t id[2]) // size and CRC32 of the tail of a file
+{
+	FILE *fp;
+	uint8_t *buf;
+	long l;
+	id[0] = id[1] = 0;
+	if ((fp = fopen(fn, "rb")) == 0) return;
+	if (fseek(fp, 0, SEEK_END) == 0 && (l = ftell(fp)) > 0) {
+		id[0] = l, l = l < 0x10000? l : 0x10000;
+		buf = (uint8_t*)malloc(l);
+		if (fseek(fp, -l, SEEK_END) == 0 && fread(buf, 1, l, fp) == (size_t)l)
+			id[1] = crc32(crc32(0L, Z_NULL, 0), buf, l);
+		free(buf);
+	}
+	fclose(fp);
+}
+
+static void bgt_get_id(const char *prefix, int64_t n_row, uint64_t id[BGT_ID_LEN])
+{
+	char *fn;
+	fn = (char*)malloc(strlen(prefix) + 9);
+	id[0] = n_row;
+	sprintf(fn, "%s.bcf", prefix);
+	bgt_file_id(fn, &id[1]);
+	sprintf(fn, "%s.pbf", prefix);
+	bgt_file_id(fn, &id[3]);
+	free(fn);
+}
+
+static int bgt_id_match(const bgt_file_t *bf, const uint64_t id[BGT_ID_LEN]) // whether an index is built from this BGT
+{
+	uint64_t x[BGT_ID_LEN];
+	if (bf->pb == 0) return 0;
+	bgt_get_id(bf->prefix, pbf_get_n(bf->pb), x);
+	return memcmp(x, id, BGT_ID_LEN * 8) == 0;
+}
+
+int bgt_jdx_build(const char *prefix, const char *fn_anno)
+{
+	fms_t *fa;
+	const char *name;
+	char *fn;
+	int absent, type;
+	int64_t i, n_anno = 0, m_anno = 0, n_pair = 0, m_pair = 0, n_row = 0, *next = 0;
+	uint32_t *hash = 0;
+	uint64_t *pair = 0, *off, *site, *voff, id[BGT_ID_LEN];
+	khash_t(s2i) *h;
+	khint_t k;
+	bgt_allele_t a, r;
+	kstring_t s = {0,0,0};
+	BGZF *fp;
+	bcf_hdr_t *h0;
+	bcf1_t *b;
+	FILE *fo;
+
+	if ((fa = fms_open(fn_anno)) == 0) return -1;
+	memset(&a, 0, sizeof(bgt_allele_t));
+	memset(&r, 0, sizeof(bgt_allele_t));
+
+	// hash annotation rows by normalized alleles; rows of the same allele are chained by next[]
+	h = kh_init(s2i);
+	while ((name = fms_read(fa, 0, 1)) != 0) {
+		if (n_anno == m_anno) {
+			m_anno = m_anno? m_anno<<1 : 1024;
+			hash = (uint32_t*)realloc(hash, m_anno * 4);
+			next = (int64_t*)realloc(next, m_anno * 8);
+		}
+		hash[n_anno] = __ac_X31_hash_string(name);
+		next[n_anno] = -1;
+		if (bgt_al_parse(name, &a) == 0) {
+			bgt_al_format(&a, &s);
+			k = kh_put(s2i, h, s.s, &absent);
+			if (absent) kh_key(h, k) = strdup(s.s), kh_val(h, k) = n_anno;
+			else next[n_anno] = next[kh_val(h, k)], next[kh_val(h, k)] = n_anno;
+		}
+		++n_anno;
+	}
+	fms_close(fa);
+
+	// match sites in the same way as al_present()
+	fn = (char*)malloc(strlen(prefix) + 9);
+	sprintf(fn, "%s.bcf", prefix);
+	if ((fp = bgzf_open(fn, "r")) == 0) {
+		n_pair = -1;
+		goto jdx_build_end;
+	}
+	h0 = bcf_hdr_read(fp);
+	b = bcf_init1();
+	for (;;) {
+		uint64_t vo = bgzf_tell(fp);
+		int64_t row;
+		if (bcf_read1(fp, b) < 0) break;
+		row = bgt_get_row(h0, b), ++n_row;
+		bgt_al_from_bcf(h0, b, &a, &r);
+		for (type = 1; type <= 2; ++type) { // record both; bgtm_set_jr() lets ALT take precedence over REF
+			bgt_al_format(type == 1? &a : &r, &s);
+			if ((k = kh_get(s2i, h, s.s)) == kh_end(h)) continue;
+			for (i = kh_val(h, k); i >= 0; i = next[i]) {
+				if (n_pair + 3 > m_pair) {
+					m_pair = m_pair? m_pair<<1 : 3072;
+					pair = (uint64_t*)realloc(pair, m_pair * 8);
+				}
+				pair[n_pair++] = i, pair[n_pair++] = (uint64_t)row<<2 | type, pair[n_pair++] = vo;
+			}
+		}
+	}
+	bcf_destroy1(b);
+	bcf_hdr_destroy(h0);
+	bgzf_close(fp);
+	n_pair /= 3;
+
+	// bucket pairs by annotation row; sites of a row remain sorted
+	off = (uint64_t*)calloc(n_anno + 1, 8);
+	site = (uint64_t*)malloc(n_pair * 8 + 1);
+	voff = (uint64_t*)malloc(n_pair * 8 + 1);
+	for (i = 0; i < n_pair; ++i) ++off[pair[i*3] + 1];
+	for (i = 1; i <= n_anno; ++i) off[i] += off[i-1];
+	for (i = 0; i < n_pair; ++i) {
+		uint64_t *p = &pair[i*3], j = off[p[0]]++;
+		site[j] = p[1], voff[j] = p[2];
+	}
+	for (i = n_anno; i > 0; --i) off[i] = off[i-1];
+	off[0] = 0;
+
+	bgt_get_id(prefix, n_row, id);
+	sprintf(fn, "%s.jdx", prefix);
+	if ((fo = fopen(fn, "wb")) != 0) {
+		fwrite("JDX\3", 1, 4, fo);
+		fwrite(id, 8, BGT_ID_LEN, fo);
+		fwrite(&n_anno, 8, 1, fo);
+		fwrite(&n_pair, 8, 1, fo);
+		fwrite(hash, 4, n_anno, fo);
+		fwrite(off, 8, n_anno + 1, fo);
+		fwrite(site, 8, n_pair, fo);
+		fwrite(voff, 8, n_pair, fo);
+		fclose(fo);
+	} else n_pair = -1;
+	free(off); free(site); free(voff);
+
+jdx_build_end:
+	for (k = 0; k < kh_end(h); ++k)
+		if (kh_exist(h, k)) free((char*)kh_key(h, k));
+	kh_destroy(s2i, h);
+	free(a.chr.s); free(r.chr.s); free(s.s);
+	free(hash); free(next); free(pair); free(fn);
+	return n_pair < 0? -1 : 0;
+}
+
+int bgt_jdx_load(bgt_file_t *bf)
+{
+	char *fn, magic[4];
+	uint64_t id[BGT_ID_LEN];
+	FILE *fp;
+	bgt_jdx_t *jdx;
+	fn = (char*)malloc(strlen(bf->prefix) + 9);
+	sprintf(fn, "%s.jdx", bf->prefix);
+	fp = fopen(fn, "rb");
+	free(fn);
+	if (fp == 0) return -1;
+	if (fread(magic, 1, 4, fp) != 4 || strncmp(magic, "JDX\3", 4) != 0 || fread(id, 8, BGT_ID_LEN, fp) != BGT_ID_LEN) {
+		fclose(fp);
+		return -1;
+	}
+	if (!bgt_id_match(bf, id)) { // stale index
+		fprintf(stderr, "[W::%s] ignored the join index of '%s' built from different data\n", __func__, bf->prefix);
+		fclose(fp);
+		return -1;
+	}
+	jdx = (bgt_jdx_t*)calloc(1, sizeof(bgt_jdx_t));
+	fread(&jdx->n_anno, 8, 1, fp);
+	fread(&jdx->n_pair, 8, 1, fp);
+	jdx->hash = (uint32_t*)malloc(jdx->n_anno * 4 + 1);
+	jdx->off  = (uint64_t*)malloc((jdx->n_anno + 1) * 8);
+	jdx->site = (uint64_t*)malloc(jdx->n_pair * 8 + 1);
+	jdx->voff = (uint64_t*)malloc(jdx->n_pair * 8 + 1);
+	fread(jdx->hash, 4, jdx->n_anno, fp);
+	fread(jdx->off, 8, jdx->n_anno + 1, fp);
+	fread(jdx->site, 8, jdx->n_pair, fp);
+	if (fread(jdx->voff, 8, jdx->n_pair, fp) != (size_t)jdx->n_pair) {
+		fclose(fp);
+		bgt_jdx_destroy(jdx);
+		return -1;
+	}
+	fclose(fp);
+	bgt_jdx_destroy(bf->jdx);
+	bf->jdx = jdx;
+	return 0;
+}
+
+void bgt_jdx_destroy(bgt_jdx_t *jdx)
+{
+	if (jdx == 0) return;
+	free(jdx->hash); free(jdx->off); free(jdx->site); free(jdx->voff);
+	free(jdx);
+}
+
+/****************
+ * Sample index *
+ ****************/
+
+/* For each sample, the sample index lists BGT rows where the sample has the
+ * ALT allele on either haplotype. File layout:
+ *
+ *   "SDX\2", n_row (int64), n_smpl (int32), id[BGT_ID_LEN], voff[n_row], off[n_smpl+1], lists
+ *
+ * where id identifies the BGT as for the join index, voff[k] is the BCF
+ * virtual offset of row k and the list of sample i takes bytes
+ * [off[i],off[i+1]) in the list block. A list keeps differences between
+ * adjacent rows (the first row for the first) as varints. Only the header and
+ * off[] are loaded; lists and offsets are read by queries. */
+
+#define BGT_SDX_HDR (16 + BGT_ID_LEN * 8) // bytes before voff[]
+
+static inline void bgt_put_varint(kstring_t *s, uint64_t x)
+{
+	uint8_t buf[10];
+	kputsn((char*)buf, pb_put_varint(buf, x) - buf, s);
+}
+
+int bgt_sdx_build(const char *prefix)
+{
+	char *fn;
+	int32_t i, n_smpl;
+	int64_t k = 0, n_row = -1, *last = 0;
+	uint64_t id[BGT_ID_LEN];
+	kstring_t *ks = 0;
+	BGZF *fp;
+	pbf_t *pb;
+	FILE *fo;
+
+	fn = (char*)malloc(strlen(prefix) + 9);
+	sprintf(fn, "%s.pbf", prefix);
+	pb = pbf_open_r(fn);
+	sprintf(fn, "%s.bcf", prefix);
+	fp = bgzf_open(fn, "r");
+	sprintf(fn, "%s.sdx", prefix);
+	fo = pb && fp? fopen(fn, "wb") : 0;
+	if (fo) {
+		bcf_hdr_t *h0;
+		bcf1_t *b;
+		n_row = pbf_get_n(pb), n_smpl = pbf_get_m(pb) >> 1;
+		bgt_get_id(prefix, n_row, id);
+		fwrite("SDX\2", 1, 4, fo);
+		fwrite(&n_row, 8, 1, fo);
+		fwrite(&n_smpl, 4, 1, fo);
+		fwrite(id, 8, BGT_ID_LEN, fo);
+		ks = (kstring_t*)calloc(n_smpl, sizeof(kstring_t));
+		last = (int64_t*)calloc(n_smpl, 8);
+		h0 = bcf_hdr_read(fp);
+		b = bcf_init1();
+		for (k = 0; k < n_row; ++k) {
+			uint64_t vo = bgzf_tell(fp);
+			const uint8_t **a;
+			if (bcf_read1(fp, b) < 0 || bgt_get_row(h0, b) != k || (a = pbf_read(pb)) == 0) break;
+			fwrite(&vo, 8, 1, fo);
+			for (i = 0; i < n_smpl; ++i)
+				if ((a[0][i<<1] && !a[1][i<<1]) || (a[0][i<<1|1] && !a[1][i<<1|1]))
+					bgt_put_varint(&ks[i], k - last[i]), last[i] = k;
+		}
+		bcf_destroy1(b);
+		bcf_hdr_destroy(h0);
+		if (k == n_row) {
+			uint64_t off = 0;
+			fwrite(&off, 8, 1, fo);
+			for (i = 0; i < n_smpl; ++i)
+				off += ks[i].l, fwrite(&off, 8, 1, fo);
+			for (i = 0; i < n_smpl; ++i)
+				fwrite(ks[i].s, 1, ks[i].l, fo);
+		}
+		for (i = 0; i < n_smpl; ++i) free(ks[i].s);
+		free(ks); free(last);
+		fclose(fo);
+		if (k != n_row) remove(fn); // the BCF and the PBF don't match
+	}
+	if (fp) bgzf_close(fp);
+	pbf_close(pb);
+	free(fn);
+	return fo && k == n_row? 0 : -1;
+}
+
+int bgt_sdx_load(bgt_file_t *bf)
+{
+	char *fn, magic[4];
+	uint64_t id[BGT_ID_LEN];
+	FILE *fp;
+	bgt_sdx_t *sdx;
+	fn = (char*)malloc(strlen(bf->prefix) + 9);
+	sprintf(fn, "%s.sdx", bf->prefix);
+	fp = fopen(fn, "rb");
+	free(fn);
+	if (fp == 0) return -1;
+	sdx = (bgt_sdx_t*)calloc(1, sizeof(bgt_sdx_t));
+	if (fread(magic, 1, 4, fp) != 4 || strncmp(magic, "SDX\2", 4) != 0 || fread(&sdx->n_row, 8, 1, fp) != 1 || fread(&sdx->n_smpl, 4, 1, fp) != 1
+		|| fread(id, 8, BGT_ID_LEN, fp) != BGT_ID_LEN)
+		goto sdx_load_err;
+	if (sdx->n_smpl != bf->f->n_rows || !bgt_id_match(bf, id)) { // stale index
+		fprintf(stderr, "[W::%s] ignored the sample index of '%s' built from different data\n", __func__, bf->prefix);
+		goto sdx_load_err;
+	}
+	sdx->off = (uint64_t*)malloc((sdx->n_smpl + 1) * 8);
+	if (fseek(fp, BGT_SDX_HDR + sdx->n_row * 8, SEEK_SET) < 0 || fread(sdx->off, 8, sdx->n_smpl + 1, fp) != (size_t)sdx->n_smpl + 1)
+		goto sdx_load_err;
+	fclose(fp);
+	bgt_sdx_destroy(bf->sdx);
+	bf->sdx = sdx;
+	return 0;
+
+sdx_load_err:
+	fclose(fp);
+	bgt_sdx_destroy(sdx);
+	return -1;
+}
+
+void bgt_sdx_destroy(bgt_sdx_t *sdx)
+{
+	if (sdx == 0) return;
+	free(sdx->off); free(sdx);
+}
+
 /**********************
  * Single BGT reading *
  **********************/
@@ -95,10 +458,11 @@ bgt_t *bgt_reader_init(const bgt_file_t *bf)
 	bgt->f = bf;
 	fn = (char*)malloc(strlen(bf->prefix) + 9);
 	sprintf(fn, "%s.pbf", bf->prefix);
-	bgt->pb = pbf_open_r(fn); // FIXME: check if .pbf is present
+	bgt->pb = bf->pb? pbf_open_r_shared(fn, bf->pb) : pbf_open_r(fn); // FIXME: check if .pbf is present
 	sprintf(fn, "%s.bcf", bf->prefix);
 	bgt->bcf = bgzf_open(fn, "rb");
 	bgt->b0 = bcf_init1();
+	bgt->row = -1;
 	bcf_seekn(bgt->bcf, bgt->f->idx, 0);
 	bgt->gtag = (uint32_t*)calloc(bgt->f->f->n_rows, 4);
 	free(fn);
@@ -109,6 +473,7 @@ void bgt_reader_destroy(bgt_t *bgt)
 {
 	bcf_destroy1(bgt->b0);
 	free(bgt->gtag); free(bgt->group); free(bgt->out);
+	free(bgt->jr); free(bgt->jo);
 	if (bgt->h_out) bcf_hdr_destroy(bgt->h_out);
 	hts_itr_destroy(bgt->itr);
 	pbf_close(bgt->pb);
@@ -116,6 +481,21 @@ void bgt_reader_destroy(bgt_t *bgt)
 	free(bgt);
 }
 
+void bgt_reader_reset(bgt_t *bgt) // clear settings for a new query, but keep files and buffers
+{
+	hts_itr_destroy(bgt->itr);
+	if (bgt->h_out) bcf_hdr_destroy(bgt->h_out);
+	free(bgt->jr); free(bgt->jo);
+	bgt->itr = 0, bgt->h_out = 0, bgt->jr = bgt->jo = 0;
+	bgt->n_jr = bgt->i_jr = 0;
+	bgt->bed = 0, bgt->bed_excl = 0, bgt->h_al = 0;
+	bgt->n_out = bgt->n_groups = bgt->mgs_def = 0;
+	bgt->row = -1, bgt->st = 0;
+	memset(bgt->gtag, 0, bgt->f->f->n_rows * 4);
+	bgt_set_start(bgt, 0);
+	bgt->b0->shared.l = 0; // mark b0 unread
+}
+
 /*** set samples, regions, etc. ***/
 
 int bgt_add_group_core(bgt_t *bgt, int n, char *const* samples, const char *expr)
@@ -197,9 +577,119 @@ int bgt_set_region(bgt_t *bgt, const char *reg)
 
 int bgt_set_start(bgt_t *bgt, int64_t i)
 {
+	bgt->last_row = -2, bgt->row = i - 1;
 	return bcf_seekn(bgt->bcf, bgt->f->idx, i);
 }
 
+int bgt_set_threads(bgt_t *bgt, int n_threads)
+{
+	return n_threads > 0? bgzf_mt(bgt->bcf, n_threads, 4) : 0;
+}
+
+int bgt_set_cursor(bgt_t *bgt, int64_t row, uint64_t voff) // resume reading from a position given by bgtm_get_cursor()
+{
+	int ret;
+	bgt->last_row = -2, bgt->row = row - 1;
+	if (bgt->jr == 0) { // check that the record at voff is the given row; rows are consecutive in the BCF
+		if (bgzf_seek(bgt->bcf, voff, SEEK_SET) < 0) return -1;
+		ret = bcf_read1(bgt->bcf, bgt->b0);
+		if (ret == -1? row != pbf_get_n(bgt->pb) : ret < 0 || bgt_get_row(bgt->f->h0, bgt->b0) != row) return -1;
+	}
+	bgt->b0->shared.l = 0; // mark b0 unread
+	if (bgt->jr) { // the reader seeks with the join index
+		int64_t lo = 0, hi = bgt->n_jr;
+		while (lo < hi) {
+			int64_t mid = (lo + hi) >> 1;
+			if ((int64_t)(bgt->jr[mid]>>2) < row) lo = mid + 1;
+			else hi = mid;
+		}
+		bgt->i_jr = lo;
+		return 0;
+	}
+	if (bgt->itr && !bgt->itr->read_rest) { // find the chunk containing voff
+		hts_itr_t *itr = bgt->itr;
+		int i;
+		for (i = 0; i < itr->n_off && itr->off[i].v <= voff; ++i);
+		if (i < itr->n_off) {
+			if (voff < itr->off[i].u) voff = itr->off[i].u;
+			itr->i = i, itr->curr_off = voff, itr->finished = 0;
+		} else itr->finished = 1; // still seek such that bgtm_get_cursor() works
+	} else if (bgt->itr) {
+		bgt->itr->curr_off = 0, bgt->itr->finished = 0;
+	}
+	return bgzf_seek(bgt->bcf, voff, SEEK_SET) < 0? -1 : 0;
+}
+
+int bgt_set_sdx(bgt_t *bgt) // the same mechanism as the join index; bgt_read_jr() reads the listed rows
+{
+	const bgt_sdx_t *sdx = bgt->f->sdx;
+	const hts_itr_t *itr = bgt->itr;
+	int i, c;
+	char *fn;
+	FILE *fp;
+	uint8_t **buf;
+	const uint8_t **p, **end;
+	int64_t *cur, l, k, m = 0, lst;
+	if (sdx == 0 || bgt->jr || bgt->n_out == 0 || (itr && itr->read_rest)) return -1;
+	fn = (char*)malloc(strlen(bgt->f->prefix) + 9);
+	sprintf(fn, "%s.sdx", bgt->f->prefix);
+	fp = fopen(fn, "rb");
+	free(fn);
+	if (fp == 0) return -1;
+	// read the row lists of output samples
+	lst = BGT_SDX_HDR + (sdx->n_row + sdx->n_smpl + 1) * 8;
+	buf = (uint8_t**)calloc(bgt->n_out, sizeof(uint8_t*));
+	p = (const uint8_t**)calloc(bgt->n_out, sizeof(uint8_t*));
+	end = (const uint8_t**)calloc(bgt->n_out, sizeof(uint8_t*));
+	cur = (int64_t*)calloc(bgt->n_out, 8);
+	for (i = 0; i < bgt->n_out; ++i) {
+		int s = bgt->out[i];
+		int64_t len = sdx->off[s+1] - sdx->off[s];
+		buf[i] = (uint8_t*)malloc(len + 1);
+		fseek(fp, lst + sdx->off[s], SEEK_SET);
+		if (fread(buf[i], 1, len, fp) != (size_t)len) len = 0;
+		p[i] = buf[i], end[i] = buf[i] + len, m += len; // a row takes at least one byte
+	}
+	// merge the lists; the first row of a list is also a difference from 0
+	bgt->jr = (uint64_t*)realloc(bgt->jr, (m + 1) * 8);
+	bgt->jo = (uint64_t*)realloc(bgt->jo, (m + 1) * 8);
+	for (i = 0; i < bgt->n_out; ++i) {
+		uint64_t x;
+		if (p[i] < end[i]) p[i] = pb_get_varint(p[i], &x), cur[i] = x;
+		else cur[i] = INT64_MAX;
+	}
+	for (k = 0;;) {
+		int64_t min = INT64_MAX;
+		for (i = 0; i < bgt->n_out; ++i)
+			min = min < cur[i]? min : cur[i];
+		if (min == INT64_MAX) break;
+		if (min > bgt->row) bgt->jr[k++] = (uint64_t)min<<2 | 1; // skip rows before bgt_set_start()
+		for (i = 0; i < bgt->n_out; ++i) {
+			uint64_t x;
+			if (cur[i] != min) continue;
+			if (p[i] < end[i]) p[i] = pb_get_varint(p[i], &x), cur[i] += x;
+			else cur[i] = INT64_MAX;
+		}
+	}
+	// read virtual offsets and keep rows in chunks of the region
+	for (l = 0, c = 0, m = 0; l < k; ++l) {
+		uint64_t vo;
+		fseek(fp, BGT_SDX_HDR + (bgt->jr[l]>>2) * 8, SEEK_SET);
+		if (fread(&vo, 8, 1, fp) != 1) break;
+		if (itr && !itr->read_rest) {
+			while (c < itr->n_off && itr->off[c].v <= vo) ++c;
+			if (c == itr->n_off) break;
+			if (vo < itr->off[c].u) continue;
+		}
+		bgt->jr[m] = bgt->jr[l], bgt->jo[m++] = vo;
+	}
+	fclose(fp);
+	for (i = 0; i < bgt->n_out; ++i) free(buf[i]);
+	free(buf); free(p); free(end); free(cur);
+	bgt->n_jr = m, bgt->i_jr = 0, bgt->last_row = -2;
+	return 0;
+}
+
 void bgt_set_bed(bgt_t *bgt, const void *bed, int excl) { bgt->bed = bed, bgt->bed_excl = excl; }
 
 /*** prepare for the output ***/
@@ -269,22 +759,44 @@ static int al_present(khash_t(str) *h, const bcf_hdr_t *hdr, const bcf1_t *b)
 	return ret;
 }
 
+static int bgt_read_jr(bgt_t *bgt) // read the next site given by the join index
+{
+	const hts_itr_t *itr = bgt->itr;
+	while (bgt->i_jr < bgt->n_jr) {
+		int64_t row = bgt->jr[bgt->i_jr] >> 2;
+		if (row != bgt->last_row + 1) // the BCF is not at the right position; seek
+			bgzf_seek(bgt->bcf, bgt->jo[bgt->i_jr], SEEK_SET);
+		bgt->jr_type = bgt->jr[bgt->i_jr++] & 3;
+		bgt->voff = bgzf_tell(bgt->bcf);
+		if (bcf_read1(bgt->bcf, bgt->b0) < 0) return -1;
+		if (bgt_get_row(bgt->f->h0, bgt->b0) != row) {
+			fprintf(stderr, "[E::%s] row %lld is not at its offset in the index\n", __func__, (long long)row);
+			return -2;
+		}
+		bgt->last_row = row;
+		if (itr && (bgt->b0->rid != itr->tid || bgt->b0->pos >= itr->end || bgt->b0->pos + bgt->b0->rlen <= itr->beg))
+			continue;
+		return 0;
+	}
+	return -1;
+}
+
 int bgt_read_core0(bgt_t *bgt)
 {
-	int i, id, row;
-	row = bgt->itr? bcf_itr_next(bgt->bcf, bgt->itr, bgt->b0) : bcf_read1(bgt->bcf, bgt->b0);
-	if (row < 0) return row;
-	assert(bgt->b0->n_sample == 0); // there shouldn't be any sample fields
-	row = -1;
-	id = bcf_id2int(bgt->f->h0, BCF_DT_ID, "_row");
-	assert(id > 0);
-	bcf_unpack(bgt->b0, BCF_UN_INFO);
-	for (i = 0; i < bgt->b0->n_info; ++i) {
-		bcf_info_t *p = &bgt->b0->d.info[i];
-		if (p->key == id) row = p->v1.i;
+	int ret;
+	if (bgt->jr) ret = bgt_read_jr(bgt);
+	else if (bgt->itr) {
+		ret = bcf_itr_next(bgt->bcf, bgt->itr, bgt->b0);
+		bgt->voff = bgt->itr->last_off;
+	} else {
+		bgt->voff = bgzf_tell(bgt->bcf);
+		ret = bcf_read1(bgt->bcf, bgt->b0);
 	}
-	assert(row >= 0);
-	return row;
+	if (ret < 0) return ret;
+	assert(bgt->b0->n_sample == 0); // there shouldn't be any sample fields
+	bgt->row = bgt_get_row(bgt->f->h0, bgt->b0);
+	assert(bgt->row >= 0);
+	return bgt->row;
 }
 
 void bgt_gen_gt(const bcf_hdr_t *h, bcf1_t *b, int m, const uint8_t **a, int32_t *mgs)
@@ -336,10 +848,31 @@ int bgt_read_rec(bgt_t *bgt, bgt_rec_t *r)
 	const uint8_t **a;
 	r->b0 = 0, r->a[0] = r->a[1] = 0;
 	if (bgt->n_out == 0) return -1;
-	if ((row = bgt_read_core(bgt)) < 0) return row;
-	r->b0 = bgt->b0;
-	pbf_seek(bgt->pb, row);
-	a = pbf_read(bgt->pb);
+	if (bgt->st) { // the same as below, but with timing
+		bgt_stats_t *st = bgt->st;
+		int64_t n_dec0, n_dec1, n_ckpt0, n_ckpt1;
+		uint64_t t0, t1, t2;
+		t0 = bgt_tick();
+		row = bgt_read_core(bgt);
+		t1 = bgt_tick();
+		st->t[BGT_ST_BCF] += t1 - t0, ++st->n[BGT_ST_BCF];
+		if (row < 0) return row;
+		r->b0 = bgt->b0;
+		pbf_get_stat(bgt->pb, &n_dec0, &n_ckpt0);
+		pbf_seek(bgt->pb, row);
+		pbf_get_stat(bgt->pb, &n_dec1, &n_ckpt1);
+		t2 = bgt_tick();
+		st->t[BGT_ST_SEEK] += t2 - t1, ++st->n[BGT_ST_SEEK];
+		st->n_row_replay += n_dec1 - n_dec0, st->n_ckpt += n_ckpt1 - n_ckpt0;
+		a = pbf_read(bgt->pb);
+		st->t[BGT_ST_DEC] += bgt_tick() - t2, ++st->n[BGT_ST_DEC];
+		st->n_row_dec += n_dec1 - n_dec0 + 1;
+	} else {
+		if ((row = bgt_read_core(bgt)) < 0) return row;
+		r->b0 = bgt->b0;
+		pbf_seek(bgt->pb, row);
+		a = pbf_read(bgt->pb);
+	}
 	r->a[0] = (uint8_t*)a[0], r->a[1] = (uint8_t*)a[1];
 	return row;
 }
@@ -374,25 +907,17 @@ bgtm_t *bgtm_reader_init(int n_files, bgt_file_t *const* bf)
 	return bm;
 }
 
-void bgtm_reader_destroy(bgtm_t *bm)
+static void bgtm_free_query(bgtm_t *bm) // free settings and results of the current query
 {
 	int i;
 	free(bm->hap);
 	free(bm->alcnt);
 	if (bm->site_flt) ke_destroy(bm->site_flt);
-	free(bm->mgs);
-	free(bm->group);
-	free(bm->sample_idx);
-	if (bm->h_out) bcf_hdr_destroy(bm->h_out);
-	free(bm->a[0]); free(bm->a[1]);
 	for (i = 0; i < bm->n_aal; ++i) free(bm->aal[i].chr.s);
 	free(bm->aal);
 	for (i = 0; i < bm->n_fields; ++i)
 		ke_destroy(bm->fields[i]);
 	free(bm->fields);
-	free(bm->tbl_line.s);
-	for (i = 0; i < bm->n_bgt; ++i)
-		bgt_reader_destroy(bm->bgt[i]);
 	if (bm->h_al) {
 		khint_t k;
 		khash_t(str) *h = (khash_t(str)*)bm->h_al;
@@ -400,9 +925,40 @@ void bgtm_reader_destroy(bgtm_t *bm)
 			if (kh_exist(h, k)) free((char*)kh_key(h, k));
 		kh_destroy(str, h);
 	}
+}
+
+void bgtm_reader_destroy(bgtm_t *bm)
+{
+	int i;
+	bgtm_free_query(bm);
+	free(bm->mgs);
+	free(bm->group);
+	free(bm->sample_idx);
+	if (bm->h_out) bcf_hdr_destroy(bm->h_out);
+	free(bm->a[0]); free(bm->a[1]);
+	free(bm->tbl_line.s); free(bm->fmt.s);
+	for (i = 0; i < bm->n_bgt; ++i)
+		bgt_reader_destroy(bm->bgt[i]);
 	free(bm->r); free(bm->bgt); free(bm);
 }
 
+void bgtm_reader_reset(bgtm_t *bm) // make the reader ready for a new query
+{
+	int i;
+	bgtm_free_query(bm);
+	bm->hap = 0, bm->alcnt = 0, bm->site_flt = 0, bm->aal = 0, bm->fields = 0, bm->h_al = 0;
+	bm->n_aal = bm->al_join = bm->n_fields = 0;
+	bm->n_out = bm->n_groups = bm->flag = bm->mgs_def = 0;
+	bm->n_gt_read = bm->n_site_read = bm->n_site_out = 0, bm->n_rec = 0;
+	memset(&bm->st, 0, sizeof(bgt_stats_t));
+	bm->tbl_line.l = bm->fmt.l = bm->fmt_off = 0;
+	if (bm->h_out) bcf_hdr_destroy(bm->h_out);
+	bm->h_out = 0;
+	for (i = 0; i < bm->n_bgt; ++i)
+		bgt_reader_reset(bm->bgt[i]);
+	memset(bm->r, 0, bm->n_bgt * sizeof(bgt_rec_t));
+}
+
 /*** set samples, regions, etc. ***/
 
 int bgtm_add_group(bgtm_t *bm, const char *expr)
@@ -432,6 +988,34 @@ int bgtm_set_start(bgtm_t *bm, int64_t n)
 	return 0;
 }
 
+int bgtm_set_threads(bgtm_t *bm, int n_threads)
+{
+	int i;
+	for (i = 0; i < bm->n_bgt; ++i)
+		bgt_set_threads(bm->bgt[i], n_threads);
+	return 0;
+}
+
+void bgtm_get_cursor(const bgtm_t *bm, int64_t *row, uint64_t *voff)
+{
+	int i;
+	for (i = 0; i < bm->n_bgt; ++i) {
+		const bgt_t *bgt = bm->bgt[i];
+		if (bm->r[i].b0) row[i] = bgt->row, voff[i] = bgt->voff; // the buffered record has not been returned
+		else row[i] = bgt->row + 1, voff[i] = bgzf_tell(bgt->bcf);
+	}
+}
+
+int bgtm_set_cursor(bgtm_t *bm, const int64_t *row, const uint64_t *voff)
+{
+	int i, ret = 0;
+	for (i = 0; i < bm->n_bgt; ++i) {
+		bm->r[i].b0 = 0;
+		if (bgt_set_cursor(bm->bgt[i], row[i], voff[i]) < 0) ret = -1;
+	}
+	return ret;
+}
+
 void bgtm_set_bed(bgtm_t *bm, const void *bed, int excl)
 {
 	int i;
@@ -474,6 +1058,39 @@ static inline bgt_allele_t *add_allele(bgt_allele_t *al, int *n, int *m, const c
 	return al;
 }
 
+static int bgtm_set_jr(bgtm_t *bm, int n, const int64_t *sel, char *const* name) // use the join index if possible
+{
+	int i, j;
+	for (i = 0; i < bm->n_bgt; ++i) { // test if the index is present and matches the annotation
+		const bgt_jdx_t *jdx = bm->bgt[i]->f->jdx;
+		if (jdx == 0) return -1;
+		for (j = 0; j < n; ++j)
+			if (sel[j] >= jdx->n_anno || jdx->hash[sel[j]] != __ac_X31_hash_string(name[j]))
+				return -1;
+	}
+	for (i = 0; i < bm->n_bgt; ++i) {
+		bgt_t *bgt = bm->bgt[i];
+		const bgt_jdx_t *jdx = bgt->f->jdx;
+		uint64_t l, k, m = 0;
+		for (j = 0; j < n; ++j) m += jdx->off[sel[j]+1] - jdx->off[sel[j]];
+		bgt->jr = (uint64_t*)realloc(bgt->jr, (m + 1) * 8);
+		bgt->jo = (uint64_t*)realloc(bgt->jo, (m + 1) * 8);
+		for (j = 0, m = 0; j < n; ++j)
+			for (l = jdx->off[sel[j]]; l < jdx->off[sel[j]+1]; ++l)
+				bgt->jr[m] = jdx->site[l], bgt->jo[m++] = jdx->voff[l];
+		radix_sort_64(bgt->jr, bgt->jr + m);
+		radix_sort_64(bgt->jo, bgt->jo + m); // virtual offsets increase with rows
+		for (l = k = 0; l < m; ++l) { // a site may match multiple annotation rows; type 1 (ALT) sorts first
+			if ((int64_t)(bgt->jr[l]>>2) <= bgt->row) continue; // skip rows before bgt_set_start()
+			if (k == 0 || bgt->jr[l]>>2 != bgt->jr[k-1]>>2)
+				bgt->jr[k] = bgt->jr[l], bgt->jo[k++] = bgt->jo[l];
+		}
+		bgt->n_jr = k, bgt->i_jr = 0, bgt->last_row = -2;
+	}
+	bm->al_join = 1;
+	return 0;
+}
+
 int bgtm_set_alleles(bgtm_t *bm, const char *expr, const fmf_t *f, const char *fn)
 {
 	int i, is_file, n_al = 0;
@@ -491,24 +1108,48 @@ int bgtm_set_alleles(bgtm_t *bm, const char *expr, const fmf_t *f, const char *f
 		}
 		free(al_str);
 	} else if (f || fn) {
-		int err, m_al = 0;
+		int err, m_al = 0, n_sel = 0, m_sel = 0;
+		int64_t *sel = 0;
+		char **name = 0;
 		kexpr_t *ke;
 		ke = ke_parse(expr, &err);
 		if (err && ke) ke_destroy(ke);
 		if (err) return -1;
 		if (f) {
-			for (i = 0; i < f->n_rows; ++i)
-				if (fmf_test(f, i, ke))
-					al = add_allele(al, &n_al, &m_al, f->rows[i].name);
+			for (i = 0; i < f->n_rows; ++i) {
+				if (!fmf_test(f, i, ke)) continue;
+				if (n_sel == m_sel) {
+					m_sel = m_sel? m_sel<<1 : 16;
+					sel = (int64_t*)realloc(sel, m_sel * 8);
+					name = (char**)realloc(name, m_sel * sizeof(char*));
+				}
+				sel[n_sel] = i, name[n_sel++] = f->rows[i].name;
+			}
 		} else {
-			fms_t *f;
+			fms_t *fs;
 			const char *s;
-			f = fms_open(fn);
-			while ((s = fms_read(f, ke, 1)) != 0)
-				al = add_allele(al, &n_al, &m_al, s);
-			fms_close(f);
+			if ((fs = fms_open(fn)) == 0) {
+				ke_destroy(ke);
+				return -1;
+			}
+			while ((s = fms_read(fs, ke, 1)) != 0) {
+				if (n_sel == m_sel) {
+					m_sel = m_sel? m_sel<<1 : 16;
+					sel = (int64_t*)realloc(sel, m_sel * 8);
+					name = (char**)realloc(name, m_sel * sizeof(char*));
+				}
+				sel[n_sel] = fms_tell(fs), name[n_sel++] = strdup(s);
+			}
+			fms_close(fs);
 		}
 		ke_destroy(ke);
+		if (bgtm_set_jr(bm, n_sel, sel, name) < 0) // no usable join index; parse alleles instead
+			for (i = 0; i < n_sel; ++i)
+				al = add_allele(al, &n_al, &m_al, name[i]);
+		if (f == 0)
+			for (i = 0; i < n_sel; ++i) free(name[i]);
+		free(name); free(sel);
+		if (bm->al_join) return n_sel;
 	} else return -1;
 	if (n_al > 0) {
 		int absent, diff_rid = 0;
@@ -594,6 +1235,8 @@ int bgtm_set_table(bgtm_t *bm, const char *fmt)
 
 /*** prepare for the output ***/
 
+static void bgtm_set_sdx(bgtm_t *bm);
+
 int bgtm_prepare(bgtm_t *bm)
 {
 	int i, j, m;
@@ -604,6 +1247,7 @@ int bgtm_prepare(bgtm_t *bm)
 
 	// prepare group and sample_idx
 	for (i = bm->n_out = 0; i < bm->n_bgt; ++i) {
+		bm->bgt[i]->st = bm->flag & BGT_F_STATS? &bm->st : 0;
 		bgt_prepare(bm->bgt[i]);
 		bm->n_out += bm->bgt[i]->n_out;
 	}
@@ -619,6 +1263,7 @@ int bgtm_prepare(bgtm_t *bm)
 		}
 	}
 	if (bm->n_groups == 0) bm->n_groups = 1;
+	bgtm_set_sdx(bm);
 	for (i = m = 0; i < bm->n_out; ++i)
 		if (bm->mgs[i] <= 1) ++m;
 	if (m == 0) bm->flag |= BGT_F_NO_GT;
@@ -665,16 +1310,71 @@ int bgtm_prepare(bgtm_t *bm)
 	bm->a[0] = (uint8_t*)realloc(bm->a[0], bm->n_out<<1);
 	bm->a[1] = (uint8_t*)realloc(bm->a[1], bm->n_out<<1);
 
-	if (bm->h_al != 0) {
+	if (bm->h_al || bm->al_join) {
+		int64_t n_aal = 0;
 		if (bm->flag&BGT_F_CNT_AL)
 			bm->alcnt = (int*)calloc(bm->n_out, sizeof(int));
 		if (bm->flag&BGT_F_CNT_HAP)
 			bm->hap = (uint64_t*)calloc(bm->n_out<<1, 8);
-		bm->aal = (bgt_allele_t*)calloc(kh_size((khash_t(str)*)bm->h_al) * 2, sizeof(bgt_allele_t));
+		if (bm->al_join)
+			for (i = 0; i < bm->n_bgt; ++i) n_aal += bm->bgt[i]->n_jr;
+		else n_aal = kh_size((khash_t(str)*)bm->h_al) * 2;
+		bm->aal = (bgt_allele_t*)calloc(n_aal + 1, sizeof(bgt_allele_t));
 	}
 	return 0;
 }
 
+/*** estimate the cost ***/
+
+static int64_t bgt_estimate_sites(const bgt_t *bgt, int64_t *n_seek)
+{
+	const hts_idx_t *idx = bgt->f->idx;
+	int64_t n = 0;
+	int i;
+	if (bgt->jr) { // exact with the join index
+		*n_seek = n = bgt->n_jr - bgt->i_jr;
+		return n;
+	}
+	if (hts_idx_voff2rec(idx, 0) < 0) { // no record index; assume all sites are read
+		*n_seek = 1;
+		return hts_idx_get_n_rec(idx);
+	}
+	if (bgt->itr) {
+		for (i = 0; i < bgt->itr->n_off; ++i) {
+			int64_t l = hts_idx_voff2rec(idx, bgt->itr->off[i].v) - hts_idx_voff2rec(idx, bgt->itr->off[i].u);
+			n += l > 0? l : 1;
+		}
+		*n_seek = bgt->itr->n_off;
+	} else {
+		n = hts_idx_get_n_rec(idx) - hts_idx_voff2rec(idx, bgzf_tell(bgt->bcf));
+		*n_seek = 1;
+	}
+	if (bgt->h_al) { // at most one ALT and one REF per requested allele
+		int64_t n_al = kh_size((khash_t(str)*)bgt->h_al) * 2;
+		if (n > n_al) n = n_al;
+		*n_seek = n;
+	}
+	return n > 0? n : 0;
+}
+
+int64_t bgtm_estimate(bgtm_t *bm, int64_t max_rec)
+{
+	int i;
+	int64_t cost = 0;
+	if (bm->h_out == 0) bgtm_prepare(bm);
+	for (i = 0; i < bm->n_bgt; ++i) {
+		bgt_t *bgt = bm->bgt[i];
+		int64_t n_site, n_seek, n_replay;
+		if (bgt->n_out == 0) continue;
+		n_site = bgt_estimate_sites(bgt, &n_seek);
+		if (max_rec >= 0 && n_site > max_rec + 1) n_site = max_rec + 1;
+		if (n_seek > n_site) n_seek = n_site;
+		n_replay = n_seek * (1LL << pbf_get_shift(bgt->pb) >> 1); // on average, half of the rows between two checkpoints are replayed
+		cost += n_site * bgt->n_out + n_replay * (pbf_get_m(bgt->pb) >> 6); // replaying is much faster than generating genotypes
+	}
+	return cost;
+}
+
 int bgtm_test_mgs(const bgtm_t *bm)
 {
 	int i, cnt[BGT_MAX_GROUPS];
@@ -718,6 +1418,25 @@ int bgtm_pass_site_flt(const bgt_info_t *ss, kexpr_t *flt)
 	return err? 0 : is_true;
 }
 
+/* The sample index is used if the site filter fails at any AN when no output
+ * sample has the ALT allele, e.g. with "AC>0" or "AC/AN>.5", such that other
+ * sites are skipped without changing the output. With multiple files, a site
+ * skipped in one file would get missing genotypes; with multiple groups, the
+ * filter can't be tested exhaustively. The index is not used in both cases. */
+static void bgtm_set_sdx(bgtm_t *bm)
+{
+	bgt_info_t ss;
+	if (bm->n_bgt != 1 || bm->n_groups != 1 || bm->site_flt == 0 || bm->al_join) return;
+	if (bm->n_out == 0 || bm->n_out > BGT_SDX_MAX_OUT || bm->bgt[0]->f->sdx == 0) return;
+	memset(&ss, 0, sizeof(bgt_info_t));
+	ss.n_groups = 1;
+	for (ss.an = 0; ss.an <= bm->n_out<<1; ++ss.an) {
+		ss.gan[0] = ss.an;
+		if (bgtm_pass_site_flt(&ss, bm->site_flt)) return;
+	}
+	bgt_set_sdx(bm->bgt[0]);
+}
+
 void bgtm_fill_info(const bcf_hdr_t *h, const bgt_info_t *ss, bcf1_t *b)
 {
 	bcf_append_info_ints(h, b, "AN", 1, &ss->an);
@@ -831,6 +1550,7 @@ int bgtm_read_core(bgtm_t *bm, bcf1_t *b)
 		bgt_t *bgt = bm->bgt[i];
 		if (bgt->n_out == 0) continue;
 		if (r->b0 && bcfcmp(b, r->b0) == 0) { // copy
+			if (bgt->jr && al_ret == 0) al_ret = bgt->jr_type;
 			r->b0 = 0;
 			memcpy(bm->a[0] + off, r->a[0], bgt->n_out<<1);
 			memcpy(bm->a[1] + off, r->a[1], bgt->n_out<<1);
@@ -849,14 +1569,22 @@ int bgtm_read_core(bgtm_t *bm, bcf1_t *b)
 	// fill AC/AN/etc and test site_flt
 	if ((bm->flag & BGT_F_SET_AC) || bm->site_flt || bm->n_fields > 0 || bm->n_groups > 1) {
 		bgt_info_t ss;
+		uint64_t t0 = 0, t1 = 0;
+		int pass;
+		if (bm->flag & BGT_F_STATS) t0 = bgt_tick();
 		bgtm_cal_info(bm, &ss);
 		bgtm_fill_info(bm->h_out, &ss, b);
 		if (bm->n_fields > 0)
 			bgtm_gen_tbl_line(bm, &ss, b);
-		if (!bgtm_pass_site_flt(&ss, bm->site_flt))
-			return 1;
+		if (bm->flag & BGT_F_STATS) t1 = bgt_tick();
+		pass = bgtm_pass_site_flt(&ss, bm->site_flt);
+		if (bm->flag & BGT_F_STATS) {
+			bm->st.t[BGT_ST_INFO] += t1 - t0, ++bm->st.n[BGT_ST_INFO];
+			if (bm->site_flt) bm->st.t[BGT_ST_FLT] += bgt_tick() - t1, ++bm->st.n[BGT_ST_FLT];
+		}
+		if (!pass) return 1;
 	}
-	if (bm->h_al) {
+	if (bm->h_al || bm->al_join) {
 		// +1 to samples having the allele
 		if ((bm->flag&BGT_F_CNT_AL) && bm->alcnt) {
 			int is_ref = (al_ret == 2);
@@ -881,12 +1609,49 @@ int bgtm_read(bgtm_t *bm, bcf1_t *b)
 {
 	int ret;
 	if (bm->h_out == 0) bgtm_prepare(bm);
-	while ((ret = bgtm_read_core(bm, b)) > 0);
-	if ((bm->flag & BGT_F_NO_GT) == 0)
+	while ((ret = bgtm_read_core(bm, b)) > 0) ++bm->n_site_read;
+	if (ret < 0) return ret;
+	++bm->n_site_read, ++bm->n_site_out;
+	if ((bm->flag & BGT_F_NO_GT) == 0) {
+		uint64_t t0 = bm->flag & BGT_F_STATS? bgt_tick() : 0;
 		bgt_gen_gt(bm->h_out, b, bm->n_out, (const uint8_t**)bm->a, bm->mgs);
+		if (bm->flag & BGT_F_STATS) bm->st.t[BGT_ST_GT] += bgt_tick() - t0, ++bm->st.n[BGT_ST_GT];
+	}
 	return ret;
 }
 
+void bgtm_get_stats(const bgtm_t *bm, bgt_stats_t *st)
+{
+	*st = bm->st;
+	st->n_gt_read = bm->n_gt_read, st->n_site_read = bm->n_site_read, st->n_site_out = bm->n_site_out;
+}
+
+int bgtm_read_fmt(bgtm_t *bm, bcf1_t *b, int64_t max_rec, uint64_t max_gt, char *buf, int size)
+{
+	int l = 0;
+	for (;;) {
+		if (bm->fmt_off < bm->fmt.l) { // copy the pending text
+			int n = bm->fmt.l - bm->fmt_off < size - l? bm->fmt.l - bm->fmt_off : size - l;
+			memcpy(buf + l, bm->fmt.s + bm->fmt_off, n);
+			l += n, bm->fmt_off += n;
+			if (l == size) break;
+		}
+		bm->fmt.l = bm->fmt_off = 0;
+		if (bm->n_rec > max_rec || bm->n_gt_read > max_gt) break;
+		if (bgtm_read(bm, b) < 0) break;
+		++bm->n_rec;
+		if (bm->n_fields > 0) kputs(bm->tbl_line.s, &bm->fmt);
+		else if (bm->flag & (BGT_F_CNT_AL|BGT_F_CNT_HAP)) continue;
+		else if (bm->flag & BGT_F_STATS) {
+			uint64_t t0 = bgt_tick();
+			vcf_format1(bm->h_out, b, &bm->fmt);
+			bm->st.t[BGT_ST_FMT] += bgt_tick() - t0, ++bm->st.n[BGT_ST_FMT];
+		} else vcf_format1(bm->h_out, b, &bm->fmt);
+		kputc('\n', &bm->fmt);
+	}
+	return l;
+}
+
 /**********************
  * Haplotype counting *
  **********************/
@@ -9,11 +9,43 @@
 #define BGT_F_NO_GT     0x0002
 #define BGT_F_CNT_AL    0x0004
 #define BGT_F_CNT_HAP   0x0008
+#define BGT_F_STATS     0x0010
+
+#define BGT_ST_BCF      0 // reading the site BCF, including BGZF inflation and site selection
+#define BGT_ST_SEEK     1 // pbf_seek(): loading checkpoints and replaying rows
+#define BGT_ST_DEC      2 // pbf_read(): decoding the requested row
+#define BGT_ST_INFO     3 // computing AC/AN and the tabular output
+#define BGT_ST_FLT      4 // evaluating the site filter
+#define BGT_ST_GT       5 // generating genotypes
+#define BGT_ST_FMT      6 // formatting output
+#define BGT_N_ST        7
 
 #define BGT_MAX_GROUPS  32
 #define BGT_MAX_ALLELES 64
 
 #define BGT_SET_ALL_SAMPLES (-1)
+#define BGT_SDX_MAX_OUT     16 // use the sample index for at most this many samples
+#define BGT_ID_LEN          5  // number of uint64_t identifying a BGT in its indices
+
+typedef struct { // join index between rows of an annotation FMF and BGT sites
+	int64_t n_anno, n_pair;
+	uint32_t *hash; // hash of annotation row names; used to detect a stale index
+	uint64_t *off;  // sites matching annotation row i are pairs [off[i],off[i+1])
+	uint64_t *site; // BGT row<<2 | allele type (1 for ALT; 2 for REF)
+	uint64_t *voff; // BCF virtual file offset of the site
+} bgt_jdx_t;
+
+typedef struct { // sample index: BGT rows where a sample has an ALT allele
+	int64_t n_row;
+	int32_t n_smpl;
+	uint64_t *off; // the row list of sample i takes bytes [off[i],off[i+1]) in the list block
+} bgt_sdx_t;
+
+typedef struct { // collected with BGT_F_STATS
+	uint64_t t[BGT_N_ST], n[BGT_N_ST]; // ticks (CPU cycles on x86) and events of each stage
+	int64_t n_row_dec, n_row_replay, n_ckpt; // PBF rows decoded, rows decoded only to reach the requested row, and checkpoints loaded
+	uint64_t n_gt_read, n_site_read, n_site_out;
+} bgt_stats_t;
 
 typedef struct {
 	char *prefix;
@@ -21,6 +53,9 @@ typedef struct {
 	bcf_hdr_t *h0; // site-only BCF header
 	hts_idx_t *idx; // BCF index
 	int32_t *mgs;
+	bgt_jdx_t *jdx; // annotation join index; loaded by bgt_jdx_load()
+	bgt_sdx_t *sdx; // sample index; loaded by bgt_sdx_load()
+	pbf_t *pb; // readers share the PBF header and checkpoint index loaded here
 } bgt_file_t;
 
 typedef struct {
@@ -34,6 +69,12 @@ typedef struct {
 	uint32_t *group, *gtag;
 	bcf_hdr_t *h_out;
 	const void *h_al; // hash table for alleles; to be set by bgtm
+	int jr_type;
+	int64_t n_jr, i_jr, last_row; // sites from the join index; to be set by bgtm
+	uint64_t *jr, *jo; // jr[i]: BGT row<<2 | allele type; jo[i]: BCF virtual offset
+	int64_t row; // row of b0; -1 if nothing has been read
+	uint64_t voff; // BCF virtual offset of b0
+	bgt_stats_t *st; // if not NULL, collect statistics; set by bgtm_prepare()
 } bgt_t;
 
 typedef struct { // during reading, these are all links
@@ -60,6 +101,7 @@ typedef struct {
 typedef struct {
 	int n_bgt, n_out, n_groups, flag;
 	uint64_t n_gt_read;
+	uint64_t n_site_read, n_site_out; // sites merged and sites returned by bgtm_read()
 	uint64_t *sample_idx;
 	uint32_t *group;
 	int32_t *mgs, mgs_def;
@@ -73,7 +115,12 @@ typedef struct {
 	kexpr_t **fields;
 	kstring_t tbl_line;
 
-	int n_aal;
+	int64_t n_rec; // number of records read by bgtm_read_fmt()
+	bgt_stats_t st;
+	size_t fmt_off; // part of ->fmt that has been copied out
+	kstring_t fmt;
+
+	int n_aal, al_join;
 	bgt_allele_t *aal;
 	void *h_al;
 	int *alcnt;
@@ -89,30 +136,71 @@ extern "C" {
 bgt_file_t *bgt_open(const char *prefix);
 void bgt_close(bgt_file_t *bgt);
 
+int bgt_jdx_build(const char *prefix, const char *fn_anno);
+int bgt_jdx_load(bgt_file_t *bf);
+void bgt_jdx_destroy(bgt_jdx_t *jdx);
+
+int bgt_sdx_build(const char *prefix);
+int bgt_sdx_load(bgt_file_t *bf);
+void bgt_sdx_destroy(bgt_sdx_t *sdx);
+
 bgt_t *bgt_reader_init(const bgt_file_t *bf);
 void bgt_reader_destroy(bgt_t *bgt);
+void bgt_reader_reset(bgt_t *bgt);
 void bgt_set_bed(bgt_t *bgt, const void *bed, int excl);
+int bgt_add_group(bgt_t *bgt, const char *expr);
 int bgt_set_region(bgt_t *bgt, const char *reg);
 int bgt_set_start(bgt_t *bgt, int64_t n);
+int bgt_set_threads(bgt_t *bgt, int n_threads); // read ahead and inflate BCF blocks with n_threads threads
+int bgt_set_cursor(bgt_t *bgt, int64_t row, uint64_t voff);
+int bgt_set_sdx(bgt_t *bgt); // only visit rows where an output sample has an ALT allele; call after bgt_prepare()
 
 int bgt_read(bgt_t *bgt, bcf1_t *b);
+void bgt_prepare(bgt_t *bgt);
+int bgt_read_core(bgt_t *bgt); // read the site only; return the row
+int bgt_read_rec(bgt_t *bgt, bgt_rec_t *r); // call bgt_prepare() first
 
 bgtm_t *bgtm_reader_init(int n_files, bgt_file_t *const*fns);
 void bgtm_reader_destroy(bgtm_t *bm);
+void bgtm_reader_reset(bgtm_t *bm);
 void bgtm_set_flag(bgtm_t *bm, int flag);
 int bgtm_set_flt_site(bgtm_t *bm, const char *expr);
 void bgtm_set_bed(bgtm_t *bm, const void *bed, int excl);
 int bgtm_set_region(bgtm_t *bm, const char *reg);
 int bgtm_set_start(bgtm_t *bm, int64_t n);
+int bgtm_set_threads(bgtm_t *bm, int n_threads);
+void bgtm_get_cursor(const bgtm_t *bm, int64_t *row, uint64_t *voff); // row and voff are arrays of size bm->n_bgt
+int bgtm_set_cursor(bgtm_t *bm, const int64_t *row, const uint64_t *voff); // call this AFTER bgtm_set_region() and bgtm_set_alleles()
 int bgtm_set_table(bgtm_t *bm, const char *fmt);
 int bgtm_set_alleles(bgtm_t *bm, const char *expr, const fmf_t *f, const char *fn); // call this AFTER bgtm_set_region()
 int bgtm_set_mgs(bgtm_t *bm, int mgs_def);
 int bgtm_add_group(bgtm_t *bm, const char *expr);
 int bgtm_add_allele(bgtm_t *bm, const char *al);
 int bgtm_prepare(bgtm_t *bm);
+int64_t bgtm_estimate(bgtm_t *bm, int64_t max_rec); // estimated bgtm_t::n_gt_read before reading
 int bgtm_test_mgs(const bgtm_t *bm);
 
 int bgtm_read(bgtm_t *bm, bcf1_t *b);
+void bgtm_cal_info(const bgtm_t *bm, bgt_info_t *ss); // AC/AN of the record just read, per group if there are multiple groups
+void bgtm_get_stats(const bgtm_t *bm, bgt_stats_t *st); // effective with BGT_F_STATS
+uint64_t bgt_tick(void); // for callers to time BGT_ST_FMT
+
+/**
+ * Read records and format them into a buffer
+ *
+ * A record is formatted as a VCF line, as a line of the tabular output if
+ * bgtm_set_table() has been called, or not at all if alleles or haplotypes
+ * are counted. A record that does not fit is continued in the next call.
+ *
+ * @param b        BCF record used for reading
+ * @param max_rec  stop when more than max_rec records have been read
+ * @param max_gt   stop when more than max_gt genotypes have been read
+ * @param buf      output buffer
+ * @param size     size of _buf_
+ *
+ * @return number of bytes written to _buf_; 0 when finished
+ */
+int bgtm_read_fmt(bgtm_t *bm, bcf1_t *b, int64_t max_rec, uint64_t max_gt, char *buf, int size);
 
 bgt_hapcnt_t *bgtm_hapcnt(const bgtm_t *bm, int *n_hap);
 char *bgtm_hapcnt_print_destroy(const bgtm_t *bm, int n_hap, bgt_hapcnt_t *hc);
@@ -126,4 +214,12 @@ void bgt_al_from_bcf(const bcf_hdr_t *h, const bcf1_t *b, bgt_allele_t *a, bgt_a
 }
 #endif
 
+static inline int bgt_popcnt64(uint64_t y) // SWAR popcount; used by ld and grm on packed haplotype bits
+{
+	y = y - ((y >> 1) & 0x5555555555555555ULL);
+	y = (y & 0x3333333333333333ULL) + ((y >> 2) & 0x3333333333333333ULL);
+	y = (y + (y >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+	return (y * 0x0101010101010101ULL) >> 56;
+}
+
 #endif
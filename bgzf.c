@@ -29,6 +29,7 @@
 #include <assert.h>
 #include <pthread.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include "bgzf.h"
 
 #if defined(_USE_KNETFILE) || defined(_USE_KURL)
@@ -77,12 +78,34 @@ static const uint8_t g_magic[19] = "\037\213\010\4\0\0\0\0\0\377\6\0\102\103\2\0
 
 #ifdef BGZF_CACHE
 typedef struct {
-	int size;
-	uint8_t *block;
-	int64_t end_offset;
-} cache_t;
+	uint64_t fid; // identity of the file; see bcache_file_id()
+	int64_t addr; // file offset of the block
+} bcache_key_t;
+
+#define bcache_hash(k) kh_int64_hash_func((k).fid ^ (uint64_t)(k).addr * 0x9E3779B97F4A7C15ULL)
+#define bcache_eq(a, b) ((a).fid == (b).fid && (a).addr == (b).addr)
+
 #include "khash.h"
-KHASH_MAP_INIT_INT64(cache, cache_t)
+KHASH_INIT(bcache, bcache_key_t, int, 1, bcache_hash, bcache_eq)
+
+typedef struct {
+	bcache_key_t key;
+	int size, clen; // uncompressed and compressed block lengths
+	int ref; // CLOCK reference bit; -1 if the slot is free
+	uint8_t *block;
+} bcache_slot_t;
+
+typedef struct {
+	int64_t max_bytes, bytes; // budget and current size of the uncompressed data in the cache
+	int64_t n_hit, n_miss;
+	int n, m, hand; // hand: the CLOCK hand
+	int n_free, m_free, *free; // stack of free slots
+	bcache_slot_t *a;
+	khash_t(bcache) *h; // key -> index in a[]
+} bcache_t;
+
+static bcache_t g_bcache;
+static pthread_mutex_t g_bcache_lock = PTHREAD_MUTEX_INITIALIZER;
 #endif
 
 static inline int ed_is_big()
@@ -110,6 +133,8 @@ static inline void packInt32(uint8_t *buffer, uint32_t value)
 	buffer[3] = value >> 24;
 }
 
+static uint64_t bcache_file_id(int fd);
+
 static BGZF *bgzf_read_init()
 {
 	BGZF *fp;
@@ -117,9 +142,6 @@ static BGZF *bgzf_read_init()
 	fp->is_write = 0;
 	fp->uncompressed_block = malloc(BGZF_MAX_BLOCK_SIZE);
 	fp->compressed_block = malloc(BGZF_MAX_BLOCK_SIZE);
-#ifdef BGZF_CACHE
-	fp->cache = kh_init(cache);
-#endif
 	return fp;
 }
 
@@ -154,6 +176,7 @@ BGZF *bgzf_open(const char *path, const char *mode)
 		if ((fpr = _bgzf_open(path, "r")) == 0) return 0;
 		fp = bgzf_read_init();
 		fp->fp = fpr;
+		fp->cache_id = bcache_file_id(_bgzf_fileno(fpr));
 	} else if (strchr(mode, 'w') || strchr(mode, 'W')) {
 		FILE *fpw;
 		if ((fpw = fopen(path, "w")) == 0) return 0;
@@ -173,6 +196,7 @@ BGZF *bgzf_dopen(int fd, const char *mode)
 		if ((fpr = _bgzf_dopen(fd, "r")) == 0) return 0;
 		fp = bgzf_read_init();
 		fp->fp = fpr;
+		fp->cache_id = bcache_file_id(_bgzf_fileno(fpr));
 	} else if (strchr(mode, 'w') || strchr(mode, 'W')) {
 		FILE *fpw;
 		if ((fpw = fdopen(fd, "w")) == 0) return 0;
@@ -221,33 +245,35 @@ static int deflate_block(BGZF *fp, int block_length)
 	return comp_size;
 }
 
-// Inflate the block in fp->compressed_block into fp->uncompressed_block
-static int inflate_block(BGZF* fp, int block_length)
+// Inflate a BGZF block of $block_length bytes into $dst; return the uncompressed length or -1 on error
+static int bgzf_uncompress(void *dst, const void *src, int block_length)
 {
 	z_stream zs;
 	zs.zalloc = NULL;
 	zs.zfree = NULL;
-	zs.next_in = (Bytef*)fp->compressed_block + 18;
+	zs.next_in = (Bytef*)src + 18;
 	zs.avail_in = block_length - 16;
-	zs.next_out = (Bytef*)fp->uncompressed_block;
+	zs.next_out = (Bytef*)dst;
 	zs.avail_out = BGZF_MAX_BLOCK_SIZE;
 
-	if (inflateInit2(&zs, -15) != Z_OK) {
-		fp->errcode |= BGZF_ERR_ZLIB;
-		return -1;
-	}
+	if (inflateInit2(&zs, -15) != Z_OK) return -1;
 	if (inflate(&zs, Z_FINISH) != Z_STREAM_END) {
 		inflateEnd(&zs);
-		fp->errcode |= BGZF_ERR_ZLIB;
-		return -1;
-	}
-	if (inflateEnd(&zs) != Z_OK) {
-		fp->errcode |= BGZF_ERR_ZLIB;
 		return -1;
 	}
+	if (inflateEnd(&zs) != Z_OK) return -1;
 	return zs.total_out;
 }
 
+// Inflate the block in fp->compressed_block into fp->uncompressed_block
+static int inflate_block(BGZF* fp, int block_length)
+{
+	int ret;
+	if ((ret = bgzf_uncompress(fp->uncompressed_block, fp->compressed_block, block_length)) < 0)
+		fp->errcode |= BGZF_ERR_ZLIB;
+	return ret;
+}
+
 static int check_header(const uint8_t *header)
 {
 	return (header[0] == 31 && header[1] == 139 && header[2] == 8 && (header[3] & 4) != 0
@@ -257,71 +283,370 @@ static int check_header(const uint8_t *header)
 }
 
 #ifdef BGZF_CACHE
-static void free_cache(BGZF *fp)
+static uint64_t bcache_file_id(int fd)
+{
+	struct stat st;
+	uint64_t x;
+	if (fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) return 0; // only cache regular files
+	x = (uint64_t)st.st_dev * 0x9E3779B97F4A7C15ULL ^ (uint64_t)st.st_ino;
+	x = x * 0xff51afd7ed558ccdULL ^ (uint64_t)st.st_size;
+	x = x * 0xc4ceb9fe1a85ec53ULL ^ (uint64_t)st.st_mtime; // a rewritten file gets a different identity
+	return x? x : 1;
+}
+
+static void bcache_clear(bcache_t *c)
+{
+	int i;
+	for (i = 0; i < c->n; ++i) free(c->a[i].block);
+	free(c->a); free(c->free);
+	if (c->h) kh_destroy(bcache, c->h);
+	c->a = 0, c->free = 0, c->h = 0;
+	c->n = c->m = c->n_free = c->m_free = c->hand = 0;
+	c->bytes = 0;
+}
+
+static void bcache_evict(bcache_t *c) // evict one block; c->bytes must be positive
+{
+	for (;;) {
+		bcache_slot_t *p;
+		if (c->hand >= c->n) c->hand = 0;
+		p = &c->a[c->hand];
+		if (p->ref > 0) p->ref = 0; // give it a second chance
+		else if (p->ref == 0) {
+			kh_del(bcache, c->h, kh_get(bcache, c->h, p->key));
+			c->bytes -= p->size;
+			free(p->block);
+			p->block = 0, p->ref = -1;
+			if (c->n_free == c->m_free) {
+				c->m_free = c->m_free? c->m_free<<1 : 16;
+				c->free = (int*)realloc(c->free, c->m_free * sizeof(int));
+			}
+			c->free[c->n_free++] = c->hand++;
+			return;
+		}
+		++c->hand;
+	}
+}
+
+void bgzf_set_cache_size(BGZF *fp, int64_t size)
+{
+	bcache_t *c = &g_bcache;
+	pthread_mutex_lock(&g_bcache_lock);
+	c->max_bytes = size > 0? size : 0;
+	if (c->max_bytes == 0) bcache_clear(c);
+	else while (c->bytes > c->max_bytes) bcache_evict(c);
+	pthread_mutex_unlock(&g_bcache_lock);
+}
+
+void bgzf_cache_stat(int64_t *n_hit, int64_t *n_miss, int64_t *bytes)
+{
+	pthread_mutex_lock(&g_bcache_lock);
+	if (n_hit) *n_hit = g_bcache.n_hit;
+	if (n_miss) *n_miss = g_bcache.n_miss;
+	if (bytes) *bytes = g_bcache.bytes;
+	pthread_mutex_unlock(&g_bcache_lock);
+}
+
+static int bcache_get(uint64_t fid, int64_t addr, void *block, int *clen) // copy the block at addr to $block; return its size, or 0 if not cached
 {
 	khint_t k;
-	khash_t(cache) *h = (khash_t(cache)*)fp->cache;
-	if (fp->is_write) return;
-	for (k = kh_begin(h); k < kh_end(h); ++k)
-		if (kh_exist(h, k)) free(kh_val(h, k).block);
-	kh_destroy(cache, h);
+	bcache_t *c = &g_bcache;
+	bcache_slot_t *p;
+	bcache_key_t key;
+	int size;
+	if (c->max_bytes == 0) return 0; // a racy read, but harmless
+	key.fid = fid, key.addr = addr;
+	pthread_mutex_lock(&g_bcache_lock);
+	if (c->h == 0 || (k = kh_get(bcache, c->h, key)) == kh_end(c->h)) {
+		if (c->max_bytes) ++c->n_miss;
+		pthread_mutex_unlock(&g_bcache_lock);
+		return 0;
+	}
+	p = &c->a[kh_val(c->h, k)];
+	p->ref = 1, ++c->n_hit;
+	size = p->size, *clen = p->clen;
+	memcpy(block, p->block, size);
+	pthread_mutex_unlock(&g_bcache_lock);
+	return size;
 }
 
-static int load_block_from_cache(BGZF *fp, int64_t block_address)
+static void bcache_put(uint64_t fid, int64_t addr, const void *block, int size, int clen) // size: uncompressed; clen: compressed
 {
+	int absent, i;
 	khint_t k;
-	cache_t *p;
-	khash_t(cache) *h = (khash_t(cache)*)fp->cache;
-	k = kh_get(cache, h, block_address);
-	if (k == kh_end(h)) return 0;
-	p = &kh_val(h, k);
+	bcache_t *c = &g_bcache;
+	bcache_slot_t *p;
+	bcache_key_t key;
+	if (fid == 0 || size > c->max_bytes) return; // also skip if the cache is disabled
+	key.fid = fid, key.addr = addr;
+	pthread_mutex_lock(&g_bcache_lock);
+	if (size > c->max_bytes) { // the budget has been changed
+		pthread_mutex_unlock(&g_bcache_lock);
+		return;
+	}
+	if (c->h == 0) c->h = kh_init(bcache);
+	if (kh_get(bcache, c->h, key) != kh_end(c->h)) { // cached by another reader in the meantime
+		pthread_mutex_unlock(&g_bcache_lock);
+		return;
+	}
+	while (c->bytes > 0 && c->bytes + size > c->max_bytes)
+		bcache_evict(c);
+	if (c->n_free > 0) i = c->free[--c->n_free];
+	else {
+		if (c->n == c->m) {
+			c->m = c->m? c->m<<1 : 256;
+			c->a = (bcache_slot_t*)realloc(c->a, c->m * sizeof(bcache_slot_t));
+		}
+		i = c->n++;
+	}
+	p = &c->a[i];
+	p->key = key, p->size = size, p->clen = clen, p->ref = 0;
+	p->block = (uint8_t*)malloc(p->size);
+	memcpy(p->block, block, p->size);
+	c->bytes += p->size;
+	k = kh_put(bcache, c->h, key, &absent);
+	kh_val(c->h, k) = i;
+	pthread_mutex_unlock(&g_bcache_lock);
+}
+
+static int load_block_from_cache(BGZF *fp, int64_t block_address)
+{
+	int size, clen;
+	if ((size = bcache_get(fp->cache_id, block_address, fp->uncompressed_block, &clen)) == 0) return 0;
 	if (fp->block_length != 0) fp->block_offset = 0;
 	fp->block_address = block_address;
-	fp->block_length = p->size;
-	memcpy(fp->uncompressed_block, p->block, BGZF_MAX_BLOCK_SIZE);
-	_bgzf_seek((_bgzf_file_t)fp->fp, p->end_offset, SEEK_SET);
-	return p->size;
+	fp->block_length = size;
+	_bgzf_seek((_bgzf_file_t)fp->fp, block_address + clen, SEEK_SET);
+	return size;
 }
 
 static void cache_block(BGZF *fp, int size)
 {
-	int ret;
-	khint_t k;
-	cache_t *p;
-	khash_t(cache) *h = (khash_t(cache)*)fp->cache;
-	if (BGZF_MAX_BLOCK_SIZE >= fp->cache_size) return;
-	if ((kh_size(h) + 1) * BGZF_MAX_BLOCK_SIZE > (uint32_t)fp->cache_size) {
-		/* A better way would be to remove the oldest block in the
-		 * cache, but here we remove a random one for simplicity. This
-		 * should not have a big impact on performance. */
-		for (k = kh_begin(h); k < kh_end(h); ++k)
-			if (kh_exist(h, k)) break;
-		if (k < kh_end(h)) {
-			free(kh_val(h, k).block);
-			kh_del(cache, h, k);
-		}
-	}
-	k = kh_put(cache, h, fp->block_address, &ret);
-	if (ret == 0) return; // if this happens, a bug!
-	p = &kh_val(h, k);
-	p->size = fp->block_length;
-	p->end_offset = fp->block_address + size;
-	p->block = (uint8_t*)malloc(BGZF_MAX_BLOCK_SIZE);
-	memcpy(kh_val(h, k).block, fp->uncompressed_block, BGZF_MAX_BLOCK_SIZE);
+	bcache_put(fp->cache_id, fp->block_address, fp->uncompressed_block, fp->block_length, size);
 }
 #else
-static void free_cache(BGZF *fp) {}
+static uint64_t bcache_file_id(int fd) { return 0; }
+static inline int bcache_get(uint64_t fid, int64_t addr, void *block, int *clen) { return 0; }
+static inline void bcache_put(uint64_t fid, int64_t addr, const void *block, int size, int clen) {}
 static int load_block_from_cache(BGZF *fp, int64_t block_address) {return 0;}
 static void cache_block(BGZF *fp, int size) {}
+void bgzf_set_cache_size(BGZF *fp, int64_t size) {}
+void bgzf_cache_stat(int64_t *n_hit, int64_t *n_miss, int64_t *bytes)
+{
+	if (n_hit) *n_hit = 0;
+	if (n_miss) *n_miss = 0;
+	if (bytes) *bytes = 0;
+}
 #endif
 
+#ifdef BGZF_MT
+
+/**************************
+ * Multi-threaded reading *
+ **************************/
+
+/* Worker threads read compressed blocks sequentially from the file (under
+ * the lock) and inflate them in parallel into a ring of n_blks slots. The
+ * reading thread consumes the slots in the file order. A seek discards all
+ * blocks read ahead; blocks being inflated are dropped when finished. Workers
+ * take blocks from the process-wide block cache when present and add the
+ * blocks they inflate, as bgzf_read_block() does without read-ahead. */
+
+#define RA_EMPTY 0
+#define RA_BUSY  1
+#define RA_READY 2
+
+typedef struct {
+	int state, errcode, clen, ulen; // clen==0 for end-of-file
+	int64_t addr; // file offset of the block
+	void *cdata, *udata;
+} rablk_t;
+
+typedef struct {
+	BGZF *fp;
+	int n_threads, n_blks, done, eof;
+	int64_t gen; // increased on each seek
+	int64_t head, tail; // the next slot to consume and to fill, respectively
+	int64_t next_addr; // file offset of the next block to read ahead
+	int64_t curr_end; // file offset following the block last consumed
+	rablk_t *blk;
+	pthread_t *tid;
+	pthread_mutex_t lock;
+	pthread_cond_t cv_work, cv_read;
+} mtread_t;
+
+static int mt_read_fill(mtread_t *mr, rablk_t *b) // read one compressed block; called with the lock held
+{
+	uint8_t *header = (uint8_t*)b->cdata;
+	int count, block_length, remaining;
+	count = _bgzf_read(mr->fp->fp, header, BLOCK_HEADER_LENGTH);
+	if (count == 0) return 0; // end-of-file
+	if (count != BLOCK_HEADER_LENGTH || !check_header(header)) {
+		b->errcode = BGZF_ERR_HEADER;
+		return -1;
+	}
+	block_length = unpackInt16((uint8_t*)&header[16]) + 1;
+	remaining = block_length - BLOCK_HEADER_LENGTH;
+	count = _bgzf_read(mr->fp->fp, header + BLOCK_HEADER_LENGTH, remaining);
+	if (count != remaining) {
+		b->errcode = BGZF_ERR_IO;
+		return -1;
+	}
+	mr->next_addr += block_length;
+	return block_length;
+}
+
+static void *mt_read_worker(void *data)
+{
+	mtread_t *mr = (mtread_t*)data;
+	pthread_mutex_lock(&mr->lock);
+	for (;;) {
+		rablk_t *b;
+		int64_t gen;
+		int ulen;
+		while (!mr->done && (mr->eof || mr->tail - mr->head >= mr->n_blks || mr->blk[mr->tail % mr->n_blks].state != RA_EMPTY))
+			pthread_cond_wait(&mr->cv_work, &mr->lock);
+		if (mr->done) break;
+		b = &mr->blk[mr->tail++ % mr->n_blks];
+		gen = mr->gen;
+		b->state = RA_BUSY, b->errcode = 0, b->ulen = 0, b->addr = mr->next_addr;
+		if (mr->fp->cache_id && (ulen = bcache_get(mr->fp->cache_id, b->addr, b->udata, &b->clen)) > 0) { // in the shared cache
+			b->ulen = ulen, mr->next_addr += b->clen;
+			_bgzf_seek(mr->fp->fp, mr->next_addr, SEEK_SET);
+		} else if ((b->clen = mt_read_fill(mr, b)) > 0) { // inflate without holding the lock
+			pthread_mutex_unlock(&mr->lock);
+			ulen = bgzf_uncompress(b->udata, b->cdata, b->clen);
+			if (ulen >= 0) bcache_put(mr->fp->cache_id, b->addr, b->udata, ulen, b->clen);
+			pthread_mutex_lock(&mr->lock);
+			if (ulen < 0) b->errcode = BGZF_ERR_ZLIB;
+			else b->ulen = ulen;
+		}
+		if (gen == mr->gen) {
+			if (b->clen <= 0 || b->errcode) mr->eof = 1; // stop reading ahead on end-of-file or error
+			b->state = RA_READY;
+		} else b->state = RA_EMPTY; // the reader has seeked away
+		pthread_cond_broadcast(&mr->cv_read);
+		pthread_cond_broadcast(&mr->cv_work);
+	}
+	pthread_mutex_unlock(&mr->lock);
+	return 0;
+}
+
+static int mt_read_init(BGZF *fp, int n_threads, int n_blks)
+{
+	int i;
+	mtread_t *mr;
+	mr = (mtread_t*)calloc(1, sizeof(mtread_t));
+	mr->fp = fp;
+	mr->n_threads = n_threads;
+	mr->n_blks = n_blks > n_threads? n_blks : n_threads;
+	mr->next_addr = mr->curr_end = _bgzf_tell((_bgzf_file_t)fp->fp);
+	mr->blk = (rablk_t*)calloc(mr->n_blks, sizeof(rablk_t));
+	for (i = 0; i < mr->n_blks; ++i) {
+		mr->blk[i].cdata = malloc(BGZF_MAX_BLOCK_SIZE);
+		mr->blk[i].udata = malloc(BGZF_MAX_BLOCK_SIZE);
+	}
+	mr->tid = (pthread_t*)calloc(mr->n_threads, sizeof(pthread_t));
+	pthread_mutex_init(&mr->lock, 0);
+	pthread_cond_init(&mr->cv_work, 0);
+	pthread_cond_init(&mr->cv_read, 0);
+	fp->mt = mr;
+	for (i = 0; i < mr->n_threads; ++i)
+		pthread_create(&mr->tid[i], 0, mt_read_worker, mr);
+	return 0;
+}
+
+static void mt_read_destroy(mtread_t *mr)
+{
+	int i;
+	pthread_mutex_lock(&mr->lock);
+	mr->done = 1;
+	pthread_cond_broadcast(&mr->cv_work);
+	pthread_mutex_unlock(&mr->lock);
+	for (i = 0; i < mr->n_threads; ++i) pthread_join(mr->tid[i], 0);
+	for (i = 0; i < mr->n_blks; ++i) {
+		free(mr->blk[i].cdata);
+		free(mr->blk[i].udata);
+	}
+	free(mr->blk); free(mr->tid);
+	pthread_cond_destroy(&mr->cv_work);
+	pthread_cond_destroy(&mr->cv_read);
+	pthread_mutex_destroy(&mr->lock);
+	free(mr);
+}
+
+static int mt_read_block(BGZF *fp)
+{
+	mtread_t *mr = (mtread_t*)fp->mt;
+	rablk_t *b;
+	void *swap;
+	pthread_mutex_lock(&mr->lock);
+	b = &mr->blk[mr->head % mr->n_blks];
+	while (b->state != RA_READY)
+		pthread_cond_wait(&mr->cv_read, &mr->lock);
+	if (b->errcode) {
+		fp->errcode |= b->errcode;
+		pthread_mutex_unlock(&mr->lock);
+		return -1;
+	}
+	if (b->clen == 0) { // end-of-file; keep the slot for subsequent calls
+		fp->block_length = 0;
+		pthread_mutex_unlock(&mr->lock);
+		return 0;
+	}
+	swap = fp->uncompressed_block, fp->uncompressed_block = b->udata, b->udata = swap;
+	if (fp->block_length != 0) fp->block_offset = 0; // Do not reset offset if this read follows a seek.
+	fp->block_address = b->addr;
+	fp->block_length = b->ulen;
+	mr->curr_end = b->addr + b->clen;
+	b->state = RA_EMPTY;
+	++mr->head;
+	pthread_cond_broadcast(&mr->cv_work);
+	pthread_mutex_unlock(&mr->lock);
+	return 0;
+}
+
+static int mt_read_seek(BGZF *fp, int64_t block_address)
+{
+	int i, ret = 0;
+	mtread_t *mr = (mtread_t*)fp->mt;
+	pthread_mutex_lock(&mr->lock);
+	if (block_address != mr->curr_end) { // not the next block to consume; cancel read-ahead
+		++mr->gen;
+		for (i = 0; i < mr->n_blks; ++i)
+			if (mr->blk[i].state == RA_READY) mr->blk[i].state = RA_EMPTY;
+		mr->head = mr->tail;
+		mr->eof = 0;
+		mr->next_addr = mr->curr_end = block_address;
+		ret = _bgzf_seek(fp->fp, block_address, SEEK_SET);
+		pthread_cond_broadcast(&mr->cv_work);
+	}
+	pthread_mutex_unlock(&mr->lock);
+	return ret;
+}
+
+#endif // ~ #ifdef BGZF_MT
+
+// file offset of the block following the current one
+static inline int64_t next_block_address(BGZF *fp)
+{
+#ifdef BGZF_MT
+	if (fp->mt) return ((mtread_t*)fp->mt)->curr_end;
+#endif
+	return _bgzf_tell((_bgzf_file_t)fp->fp);
+}
+
 int bgzf_read_block(BGZF *fp)
 {
 	uint8_t header[BLOCK_HEADER_LENGTH], *compressed_block;
 	int count, size = 0, block_length, remaining;
 	int64_t block_address;
+#ifdef BGZF_MT
+	if (fp->mt) return mt_read_block(fp);
+#endif
 	block_address = _bgzf_tell((_bgzf_file_t)fp->fp);
-	if (fp->cache_size && load_block_from_cache(fp, block_address)) return 0;
+
+	if (fp->cache_id && load_block_from_cache(fp, block_address)) return 0;
 	count = _bgzf_read(fp->fp, header, sizeof(header));
 	if (count == 0) { // no data read
 		fp->block_length = 0;
@@ -372,7 +697,7 @@ ssize_t bgzf_read(BGZF *fp, void *data, ssize_t length)
 		bytes_read += copy_length;
 	}
 	if (fp->block_offset == fp->block_length) {
-		fp->block_address = _bgzf_tell((_bgzf_file_t)fp->fp);
+		fp->block_address = next_block_address(fp);
 		fp->block_offset = fp->block_length = 0;
 	}
 	return bytes_read;
@@ -432,7 +757,9 @@ int bgzf_mt(BGZF *fp, int n_threads, int n_sub_blks)
 	int i;
 	mtaux_t *mt;
 	pthread_attr_t attr;
-	if (!fp->is_write || fp->mt || n_threads <= 1) return -1;
+	if (fp->mt || n_threads < 1) return -1;
+	if (!fp->is_write) return mt_read_init(fp, n_threads, n_threads * n_sub_blks);
+	if (n_threads <= 1) return -1;
 	mt = (mtaux_t*)calloc(1, sizeof(mtaux_t));
 	mt->n_threads = n_threads;
 	mt->n_blks = n_threads * n_sub_blks;
@@ -603,28 +930,36 @@ int bgzf_close(BGZF* fp)
 		if (fp->mt) mt_destroy((mtaux_t*)fp->mt);
 #endif
 	}
+#ifdef BGZF_MT
+	if (!fp->is_write && fp->mt) mt_read_destroy((mtread_t*)fp->mt);
+#endif
 	ret = fp->is_write? fclose((FILE*)fp->fp) : _bgzf_close(fp->fp);
 	if (ret != 0) return -1;
 	free(fp->uncompressed_block);
 	free(fp->compressed_block);
-	free_cache(fp);
 	free(fp);
 	return 0;
 }
 
-void bgzf_set_cache_size(BGZF *fp, int cache_size)
-{
-	if (fp) fp->cache_size = cache_size;
-}
 
 int bgzf_check_EOF(BGZF *fp)
 {
 	uint8_t buf[28];
 	off_t offset;
+	int ret = 0;
+#ifdef BGZF_MT
+	if (fp->mt && !fp->is_write) pthread_mutex_lock(&((mtread_t*)fp->mt)->lock); // workers share the file position
+#endif
 	offset = _bgzf_tell((_bgzf_file_t)fp->fp);
-	if (_bgzf_seek(fp->fp, -28, SEEK_END) < 0) return 0;
-	_bgzf_read(fp->fp, buf, 28);
-	_bgzf_seek(fp->fp, offset, SEEK_SET);
+	if (_bgzf_seek(fp->fp, -28, SEEK_END) >= 0) {
+		_bgzf_read(fp->fp, buf, 28);
+		_bgzf_seek(fp->fp, offset, SEEK_SET);
+		ret = 1;
+	}
+#ifdef BGZF_MT
+	if (fp->mt && !fp->is_write) pthread_mutex_unlock(&((mtread_t*)fp->mt)->lock);
+#endif
+	if (ret == 0) return 0;
 	return (memcmp("\037\213\010\4\0\0\0\0\0\377\6\0\102\103\2\0\033\0\3\0\0\0\0\0\0\0\0\0", buf, 28) == 0)? 1 : 0;
 }
 
@@ -639,6 +974,18 @@ int64_t bgzf_seek(BGZF* fp, int64_t pos, int where)
 	}
 	block_offset = pos & 0xFFFF;
 	block_address = pos >> 16;
+	if (fp->block_length > 0 && block_address == fp->block_address && block_offset < fp->block_length) {
+		fp->block_offset = block_offset; // in the block already inflated; the file and read-ahead stay at the next block
+		return 0;
+	}
+#ifdef BGZF_MT
+	if (fp->mt) {
+		if (mt_read_seek(fp, block_address) < 0) {
+			fp->errcode |= BGZF_ERR_IO;
+			return -1;
+		}
+	} else
+#endif
 	if (_bgzf_seek(fp->fp, block_address, SEEK_SET) < 0) {
 		fp->errcode |= BGZF_ERR_IO;
 		return -1;
@@ -670,7 +1017,7 @@ int bgzf_getc(BGZF *fp)
 	}
 	c = ((unsigned char*)fp->uncompressed_block)[fp->block_offset++];
     if (fp->block_offset == fp->block_length) {
-        fp->block_address = _bgzf_tell((_bgzf_file_t)fp->fp);
+        fp->block_address = next_block_address(fp);
         fp->block_offset = 0;
         fp->block_length = 0;
     }
@@ -703,7 +1050,7 @@ int bgzf_getline(BGZF *fp, int delim, kstring_t *str)
 		str->l += l;
 		fp->block_offset += l + 1;
 		if (fp->block_offset >= fp->block_length) {
-			fp->block_address = _bgzf_tell((_bgzf_file_t)fp->fp);
+			fp->block_address = next_block_address(fp);
 			fp->block_offset = 0;
 			fp->block_length = 0;
 		} 
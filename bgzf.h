@@ -43,11 +43,10 @@
 
 typedef struct {
 	int errcode:16, is_write:2, is_be:2, compress_level:12;
-	int cache_size;
     int block_length, block_offset;
     int64_t block_address;
     void *uncompressed_block, *compressed_block;
-	void *cache; // a pointer to a hash table
+	uint64_t cache_id; // identity of the file in the shared block cache; 0 if not cached
 	void *fp; // actual file handler; FILE* on writing; FILE* or knetFile* on reading
 #ifdef BGZF_MT
 	void *mt; // only used for multi-threading
@@ -161,10 +160,24 @@ extern "C" {
 	/**
 	 * Set the cache size. Only effective when compiled with -DBGZF_CACHE.
 	 *
-	 * @param fp    BGZF file handler
-	 * @param size  size of cache in bytes; 0 to disable caching (default)
+	 * The cache is shared by all handles opened for reading in the process and is thread
+	 * safe. A block is keyed by the identity of the file (device, inode, size and mtime)
+	 * and its offset, such that handles on the same file share cached blocks. Blocks are
+	 * evicted in the CLOCK order (an approximation of LRU) when the cache is full.
+	 *
+	 * @param fp    BGZF file handler; unused as the cache is process-wide
+	 * @param size  size of cache in bytes (uncompressed data); 0 to disable caching (default)
 	 */
-	void bgzf_set_cache_size(BGZF *fp, int size);
+	void bgzf_set_cache_size(BGZF *fp, int64_t size);
+
+	/**
+	 * Get the statistics of the shared block cache
+	 *
+	 * @param n_hit   number of blocks served from the cache
+	 * @param n_miss  number of blocks read and inflated while the cache is enabled
+	 * @param bytes   size of uncompressed data in the cache
+	 */
+	void bgzf_cache_stat(int64_t *n_hit, int64_t *n_miss, int64_t *bytes);
 
 	/**
 	 * Flush the file if the remaining buffer size is smaller than _size_ 
@@ -195,11 +208,17 @@ extern "C" {
 
 #ifdef BGZF_MT
 	/**
-	 * Enable multi-threading (only effective on writing)
+	 * Enable multi-threading
+	 *
+	 * On writing, blocks are compressed in parallel. On reading, worker threads
+	 * inflate up to n_threads*n_sub_blks blocks ahead of the reader; a seek
+	 * discards the blocks read ahead. Workers use and fill the shared block
+	 * cache (see bgzf_set_cache_size()) as single-threaded reading does.
 	 *
-	 * @param fp          BGZF file handler; must be opened for writing
-	 * @param n_threads   #threads used for writing
+	 * @param fp          BGZF file handler
+	 * @param n_threads   #threads used for writing or reading
 	 * @param n_sub_blks  #blocks processed by each thread; a value 64-256 is recommended
+	 *                    on writing and 2-8 on reading
 	 */
 	int bgzf_mt(BGZF *fp, int n_threads, int n_sub_blks);
 #endif
@@ -159,6 +159,7 @@ struct fms_s {
 	kstream_t *ks;
 	kstring_t s;
 	gzFile fp;
+	int64_t n_rows; // number of non-empty lines read so far
 };
 
 fms_t *fms_open(const char *fn)
@@ -189,6 +190,7 @@ static int fms_read_and_test(fms_t *f, kexpr_t *ke, char **end0)
 	ret = ks_getuntil(f->ks, KS_SEP_LINE, &f->s, &dret);
 	if (ret < 0) return ret;
 	if (f->s.l == 0) return 0;
+	++f->n_rows;
 	if (ke) ke_unset(ke);
 	for (p = q = f->s.s, i = 0;; ++p) {
 		if (*p == 0 || *p == '\t') {
@@ -226,6 +228,8 @@ const char *fms_read(fms_t *f, kexpr_t *ke, int name_only)
 	return f->s.s;
 }
 
+int64_t fms_tell(const fms_t *f) { return f->n_rows - 1; }
+
 #ifndef FMF_LIB_ONLY
 #include <unistd.h>
 
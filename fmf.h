@@ -49,6 +49,7 @@ int fmf_test(const fmf_t *f, int r, kexpr_t *ke);
 fms_t *fms_open(const char *fn);
 void fms_close(fms_t *f);
 const char *fms_read(fms_t *f, kexpr_t *ke, int name_only);
+int64_t fms_tell(const fms_t *f); // index of the row last returned by fms_read(); consistent with fmf_t::rows
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,202 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <pthread.h>
+#include "bgt.h"
+
+/* KING-robust kinship between samples j and k is
+ *
+ *   (N_het,het - 2 N_opposite_hom) / (N_het(j) + N_het(k))
+ *
+ * where the counts are taken over sites called in both samples. Genotypes of
+ * GRM_BLK sites are packed into three bit planes per sample: HET, HOM_ALT and
+ * HOM_REF; a missing genotype or one with another ALT allele sets no bit. When
+ * a block is full, each pair of samples adds popcounts of ANDed planes to its
+ * counters. Samples are tiled into GRM_TILE x GRM_TILE squares, such that the
+ * planes of a tile stay in cache; threads take different tiles. The counters
+ * take 12 bytes per pair of samples. */
+
+#define GRM_BLK  1024 // sites per block
+#define GRM_NW   (GRM_BLK / 64)
+#define GRM_TILE 64
+
+typedef struct {
+	uint32_t hethet, ibs0, het; // het: N_het(j) + N_het(k) at sites called in both
+} grm_cnt_t;
+
+typedef struct {
+	int n, n_tiles;
+	uint64_t *bits; // HET, HOM_ALT and HOM_REF planes of sample i at bits[i*3*GRM_NW]
+	grm_cnt_t *cnt; // pair (j,k) for j<k at cnt[k*(k-1)/2+j]
+} grm_aux_t;
+
+typedef struct {
+	grm_aux_t *aux;
+	int tid, n_threads;
+} grm_worker_t;
+
+static void grm_tile(grm_aux_t *aux, int t1, int t2) // t1 <= t2
+{
+	int j, k, w, k_end = (t2 + 1) * GRM_TILE < aux->n? (t2 + 1) * GRM_TILE : aux->n;
+	for (k = t2 * GRM_TILE; k < k_end; ++k) {
+		const uint64_t *hk = &aux->bits[(size_t)k * 3 * GRM_NW], *ak = hk + GRM_NW, *rk = ak + GRM_NW;
+		int j_end = t1 < t2? (t1 + 1) * GRM_TILE : k;
+		grm_cnt_t *c = &aux->cnt[(int64_t)k * (k - 1) / 2];
+		for (j = t1 * GRM_TILE; j < j_end; ++j) {
+			const uint64_t *hj = &aux->bits[(size_t)j * 3 * GRM_NW], *aj = hj + GRM_NW, *rj = aj + GRM_NW;
+			int hh = 0, ibs0 = 0, het = 0;
+			for (w = 0; w < GRM_NW; ++w) {
+				uint64_t cj = hj[w] | aj[w] | rj[w], ck = hk[w] | ak[w] | rk[w];
+				hh += bgt_popcnt64(hj[w] & hk[w]);
+				ibs0 += bgt_popcnt64((aj[w] & rk[w]) | (rj[w] & ak[w]));
+				het += bgt_popcnt64(hj[w] & ck) + bgt_popcnt64(hk[w] & cj);
+			}
+			c[j].hethet += hh, c[j].ibs0 += ibs0, c[j].het += het;
+		}
+	}
+}
+
+static void *grm_worker(void *data)
+{
+	grm_worker_t *w = (grm_worker_t*)data;
+	int t1, t2, i = 0;
+	for (t2 = 0; t2 < w->aux->n_tiles; ++t2)
+		for (t1 = 0; t1 <= t2; ++t1, ++i)
+			if (i % w->n_threads == w->tid)
+				grm_tile(w->aux, t1, t2);
+	return 0;
+}
+
+static void grm_flush(grm_aux_t *aux, int n_threads)
+{
+	int i;
+	pthread_t *tid;
+	grm_worker_t *w;
+	tid = (pthread_t*)calloc(n_threads, sizeof(pthread_t));
+	w = (grm_worker_t*)calloc(n_threads, sizeof(grm_worker_t));
+	for (i = 0; i < n_threads; ++i) {
+		w[i].aux = aux, w[i].tid = i, w[i].n_threads = n_threads;
+		pthread_create(&tid[i], 0, grm_worker, &w[i]);
+	}
+	for (i = 0; i < n_threads; ++i) pthread_join(tid[i], 0);
+	free(w); free(tid);
+	memset(aux->bits, 0, (size_t)aux->n * 3 * GRM_NW * 8);
+}
+
+int main_grm(int argc, char *argv[])
+{
+	int i, j, c, n_threads = 1, n_files, n_groups = 0, n_blk = 0;
+	int64_t n_sites = 0;
+	char *reg = 0, *site_flt = 0, *prefix = 0, *fn, *gexpr[BGT_MAX_GROUPS];
+	bgt_file_t **files;
+	bgtm_t *bm;
+	bcf1_t *b;
+	grm_aux_t aux;
+	float *row;
+	FILE *fp;
+
+	while ((c = getopt(argc, argv, "s:r:f:o:t:")) >= 0) {
+		if (c == 's' && n_groups < BGT_MAX_GROUPS) gexpr[n_groups++] = optarg;
+		else if (c == 'r') reg = optarg;
+		else if (c == 'f') site_flt = optarg;
+		else if (c == 'o') prefix = optarg;
+		else if (c == 't') n_threads = atoi(optarg);
+	}
+	if (optind == argc || prefix == 0) {
+		fprintf(stderr, "Usage: bgt grm [options] -o <out-prefix> <bgt-prefix> [...]\n");
+		fprintf(stderr, "Options:\n");
+		fprintf(stderr, "  -o STR     write the matrix to STR.bin and sample names to STR.id [required]\n");
+		fprintf(stderr, "  -s EXPR    samples list (,sample1,sample2 or a file or expression) [all]\n");
+		fprintf(stderr, "  -r STR     region [all]\n");
+		fprintf(stderr, "  -f STR     site filter as with 'view', e.g. 'AC/AN>=.01&&AC/AN<=.99' []\n");
+		fprintf(stderr, "  -t INT     number of threads [%d]\n", n_threads);
+		fprintf(stderr, "Output: KING-robust kinship as an n-by-n matrix of float32 in the native byte order, rows and columns in the order of STR.id\n");
+		return 1;
+	}
+	if (n_threads < 1) n_threads = 1;
+
+	n_files = argc - optind;
+	files = (bgt_file_t**)calloc(n_files, sizeof(bgt_file_t*));
+	for (i = 0; i < n_files; ++i) {
+		if ((files[i] = bgt_open(argv[optind+i])) == 0) {
+			fprintf(stderr, "[E::%s] failed to open BGT with prefix '%s'\n", __func__, argv[optind+i]);
+			return 1;
+		}
+	}
+	bm = bgtm_reader_init(n_files, files);
+	bgtm_set_flag(bm, BGT_F_NO_GT);
+	if (site_flt && bgtm_set_flt_site(bm, site_flt) != 0) {
+		fprintf(stderr, "[E::%s] failed to set frequency filters. Syntax error?\n", __func__);
+		return 1;
+	}
+	if (reg && bgtm_set_region(bm, reg) < 0) {
+		fprintf(stderr, "[E::%s] failed to set region. Region format error?\n", __func__);
+		return 1;
+	}
+	for (i = 0; i < n_groups; ++i) {
+		if (bgtm_add_group(bm, gexpr[i]) < 0) {
+			fprintf(stderr, "[E::%s] failed to add sample group '%s'.\n", __func__, gexpr[i]);
+			return 1;
+		}
+	}
+	bgtm_prepare(bm);
+
+	aux.n = bm->n_out, aux.n_tiles = (aux.n + GRM_TILE - 1) / GRM_TILE;
+	aux.bits = (uint64_t*)calloc((size_t)aux.n * 3 * GRM_NW, 8);
+	aux.cnt = (grm_cnt_t*)calloc((int64_t)aux.n * (aux.n - 1) / 2 + 1, sizeof(grm_cnt_t));
+	if (aux.cnt == 0) {
+		fprintf(stderr, "[E::%s] failed to allocate counters for %d samples\n", __func__, aux.n);
+		return 1;
+	}
+	b = bcf_init1();
+	while (bgtm_read(bm, b) >= 0) {
+		uint64_t bit = 1ULL << (n_blk & 63), *p = &aux.bits[n_blk >> 6];
+		for (i = 0; i < aux.n; ++i, p += 3 * GRM_NW) {
+			int c1 = bm->a[1][i<<1] << 1 | bm->a[0][i<<1], c2 = bm->a[1][i<<1|1] << 1 | bm->a[0][i<<1|1];
+			if (c1 > 1 || c2 > 1) continue; // missing or another ALT allele
+			p[(c1 + c2 == 1? 0 : c1 + c2 == 2? 1 : 2) * GRM_NW] |= bit;
+		}
+		++n_sites;
+		if (++n_blk == GRM_BLK) grm_flush(&aux, n_threads), n_blk = 0;
+	}
+	if (n_blk > 0) grm_flush(&aux, n_threads);
+	bcf_destroy1(b);
+	fprintf(stderr, "[M::%s] used %lld sites for %d samples\n", __func__, (long long)n_sites, aux.n);
+
+	fn = (char*)malloc(strlen(prefix) + 5);
+	sprintf(fn, "%s.id", prefix);
+	if ((fp = fopen(fn, "w")) == 0) {
+		fprintf(stderr, "[E::%s] failed to write to file '%s'\n", __func__, fn);
+		return 1;
+	}
+	for (i = 0; i < aux.n; ++i)
+		fprintf(fp, "%s\n", bm->bgt[bm->sample_idx[i]>>32]->f->f->rows[(uint32_t)bm->sample_idx[i]].name);
+	fclose(fp);
+	sprintf(fn, "%s.bin", prefix);
+	if ((fp = fopen(fn, "wb")) == 0) {
+		fprintf(stderr, "[E::%s] failed to write to file '%s'\n", __func__, fn);
+		return 1;
+	}
+	row = (float*)malloc(aux.n * sizeof(float));
+	for (j = 0; j < aux.n; ++j) {
+		for (i = 0; i < aux.n; ++i) {
+			const grm_cnt_t *x;
+			if (i == j) {
+				row[i] = .5f;
+				continue;
+			}
+			x = i < j? &aux.cnt[(int64_t)j * (j - 1) / 2 + i] : &aux.cnt[(int64_t)i * (i - 1) / 2 + j];
+			row[i] = x->het? ((double)x->hethet - 2. * x->ibs0) / x->het : NAN;
+		}
+		fwrite(row, sizeof(float), aux.n, fp);
+	}
+	fclose(fp);
+
+	free(row); free(fn); free(aux.bits); free(aux.cnt);
+	bgtm_reader_destroy(bm);
+	for (i = 0; i < n_files; ++i) bgt_close(files[i]);
+	free(files);
+	return 0;
+}
@@ -874,6 +874,7 @@ int hts_itr_next(BGZF *fp, hts_itr_t *iter, void *r, hts_readrec_f readrec, void
 			bgzf_seek(fp, iter->curr_off, SEEK_SET);
 			iter->curr_off = 0; // only seek once
 		}
+		iter->last_off = bgzf_tell(fp);
 		ret = readrec(fp, hdr, r, &tid, &beg, &end);
 		if (ret < 0) iter->finished = 1;
 		return ret;
@@ -888,6 +889,7 @@ int hts_itr_next(BGZF *fp, hts_itr_t *iter, void *r, hts_readrec_f readrec, void
 			}
 			++iter->i;
 		}
+		iter->last_off = bgzf_tell(fp);
 		if ((ret = readrec(fp, hdr, r, &tid, &beg, &end)) >= 0) {
 			iter->curr_off = bgzf_tell(fp);
 			if (tid != iter->tid || beg >= iter->end) { // no need to proceed
@@ -906,6 +908,29 @@ int hts_idx_seekn_aux(BGZF *fp, const hts_idx_t *idx, int64_t r)
 	return r & (((1<<idx->rec_shift) - 1));
 }
 
+int64_t hts_idx_get_n_rec(const hts_idx_t *idx) { return idx->n_rec; }
+
+static inline double voff2pos(uint64_t voff) { return (voff>>16) + (voff&0xffff) / 16.0; } // monotonic if the compression ratio is below 16
+
+int64_t hts_idx_voff2rec(const hts_idx_t *idx, uint64_t voff)
+{
+	int64_t lo = 0, hi = idx->ridx.n, x;
+	if (idx->ridx.n == 0) return -1;
+	while (lo < hi) { // find the first record block starting after voff
+		int64_t mid = (lo + hi) >> 1;
+		if (idx->ridx.offset[mid] <= voff) lo = mid + 1;
+		else hi = mid;
+	}
+	if (lo == 0) return 0;
+	x = (lo - 1) << idx->rec_shift;
+	if (lo < idx->ridx.n) { // interpolate between two record blocks
+		double a = voff2pos(idx->ridx.offset[lo-1]), b = voff2pos(idx->ridx.offset[lo]);
+		double c = voff2pos(voff), f = b > a? (c < b? (c - a) / (b - a) : 1.) : 0.;
+		x += (int64_t)(f * (1<<idx->rec_shift) + .499);
+	} else if (voff > idx->ridx.offset[lo-1]) x += ((int64_t)idx->n_rec - x) / 2; // in the last block; the end offset is unknown
+	return x < (int64_t)idx->n_rec? x : idx->n_rec;
+}
+
 /**********************
  *** Retrieve index ***
  **********************/
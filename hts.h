@@ -86,7 +86,7 @@ typedef struct {
 typedef struct {
 	uint32_t read_rest:1, finished:1, dummy:29;
 	int tid, beg, end, n_off, i;
-	uint64_t curr_off;
+	uint64_t curr_off, last_off; // last_off: virtual offset of the last record read
 	hts_pair64_t *off;
 } hts_itr_t;
 
@@ -118,6 +118,8 @@ extern "C" {
 	typedef int (*hts_name2id_f)(void*, const char*);
 
 	int hts_idx_seekn_aux(BGZF *fp, const hts_idx_t *idx, int64_t n);
+	int64_t hts_idx_get_n_rec(const hts_idx_t *idx);
+	int64_t hts_idx_voff2rec(const hts_idx_t *idx, uint64_t voff); // approximate #records before _voff_ with the record index; -1 if absent
 	hts_itr_t *hts_itr_querys(const hts_idx_t *idx, const char *reg, hts_name2id_f getid, void *hdr);
 	int hts_itr_next(BGZF *fp, hts_itr_t *iter, void *r, hts_readrec_f readrec, void *hdr);
 
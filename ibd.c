@@ -0,0 +1,271 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <pthread.h>
+#include "bgt.h"
+
+/* All pairs of haplotypes sharing a match of at least -L sites (or -b bp)
+ * are found with Algorithm 3 of Durbin (2014) on the ALT bit of each
+ * genotype; a missing genotype is taken as REF. Matches are cut at the start
+ * of each region or contig.
+ *
+ * A region is split into parts at PBF checkpoints, one part per thread. A
+ * part starts with S loaded from the checkpoint. If the PBF has divergence
+ * arrays (bgt import -D), D is loaded along with S. Otherwise, the first pass
+ * computes D at the end of each part as if matches started at the beginning
+ * of the part. D at the next part is then stitched sequentially: if a pair of
+ * haplotypes matches across a whole part, the start of the match is the
+ * maximum D between them at the beginning of the part, which is a range
+ * maximum query. The second pass reports matches ending in each part. */
+
+typedef struct {
+	int64_t beg, end; // rows [beg,end)
+	int32_t *S, *D;   // S and D at beg; D is NULL if loaded from the PBF
+	int32_t *D1;      // the first pass: D at end, with matches starting at beg
+	kstring_t out;
+} ibd_part_t;
+
+typedef struct {
+	const bgt_file_t *bf;
+	char *fn;
+	int n_hap, L, Lbp, rid, has_div, pass, n_parts, next;
+	int64_t row_beg, row_end;
+	const int32_t *pos; // pos[i]: position of row row_beg+i
+	ibd_part_t *parts;
+	pthread_mutex_t lock;
+} ibd_shared_t;
+
+static int64_t ibd_thres(const ibd_shared_t *s, int64_t k) // the largest start row of a long enough match ending at k-1
+{
+	int64_t lo, hi, e;
+	if (s->Lbp <= 0) return k - s->L;
+	if (k == s->row_beg) return s->row_beg - 1;
+	e = s->pos[k - 1 - s->row_beg];
+	for (lo = s->row_beg, hi = k; lo < hi;) { // the first row with pos > e - Lbp + 1
+		int64_t mid = (lo + hi) >> 1;
+		if (s->pos[mid - s->row_beg] > e - s->Lbp + 1) hi = mid;
+		else lo = mid + 1;
+	}
+	return lo - 1;
+}
+
+static void ibd_print(const ibd_shared_t *s, kstring_t *out, int x, int y, int64_t beg, int64_t end) // [beg,end) in rows
+{
+	const fmf_t *f = s->bf->f;
+	if (x > y) { int t = x; x = y; y = t; }
+	ksprintf(out, "%s:%d\t%s:%d\t%s\t%d\t%d\t%lld\n", f->rows[x>>1].name, (x&1) + 1, f->rows[y>>1].name, (y&1) + 1,
+			 s->bf->h0->id[BCF_DT_CTG][s->rid].key, s->pos[beg - s->row_beg] + 1, s->pos[end - 1 - s->row_beg] + 1, (long long)(end - beg));
+}
+
+// report matches ending at row k; a is row k, or NULL to report all matches at the end
+static void ibd_scan(const ibd_shared_t *s, kstring_t *out, int64_t k, const int32_t *S, const int32_t *D, const uint8_t *a)
+{
+	int64_t t = ibd_thres(s, k);
+	int i, i0, j, n1;
+	for (i = 1, i0 = 0, n1 = a && a[S[0]]; i <= s->n_hap; ++i) {
+		int32_t d = i < s->n_hap && D[i] > s->row_beg? D[i] : s->row_beg;
+		if (i < s->n_hap && d <= t) {
+			n1 += a && a[S[i]];
+			continue;
+		}
+		if (i - i0 > 1 && (a == 0 || (n1 > 0 && n1 < i - i0))) { // a block [i0,i) with different alleles at k
+			for (j = i0; j < i; ++j) {
+				int l;
+				int32_t m = 0;
+				for (l = j + 1; l < i; ++l) {
+					if (D[l] > m) m = D[l];
+					if (a == 0 || a[S[j]] != a[S[l]])
+						ibd_print(s, out, S[j], S[l], m > s->row_beg? m : s->row_beg, k);
+				}
+			}
+		}
+		i0 = i, n1 = i < s->n_hap && a && a[S[i]];
+	}
+}
+
+static void ibd_part(ibd_shared_t *s, ibd_part_t *p, int is_last)
+{
+	pbf_t *pb;
+	int32_t *S0, *D0, *D1, *t;
+	int64_t k;
+	int m = s->n_hap;
+	pb = pbf_open_r_shared(s->fn, s->bf->pb);
+	if (s->has_div) pbf_set_div(pb);
+	pbf_seek(pb, p->beg);
+	S0 = (int32_t*)malloc(m * 4);
+	D0 = (int32_t*)malloc(m * 4);
+	D1 = (int32_t*)malloc(m * 4);
+	memcpy(S0, pbf_get_S(pb, 0), m * 4);
+	if (s->has_div) memcpy(D0, pbf_get_div(pb, 0), m * 4);
+	else if (s->pass == 1) for (k = 0; k < m; ++k) D0[k] = p->beg;
+	else memcpy(D0, p->D, m * 4);
+	if (s->pass == 1) p->S = (int32_t*)malloc(m * 4), memcpy(p->S, S0, m * 4);
+	for (k = p->beg; k < p->end; ++k) {
+		const uint8_t *a = pbf_read(pb)[0];
+		if (s->pass == 2) ibd_scan(s, &p->out, k, S0, D0, a);
+		if (s->has_div) memcpy(D0, pbf_get_div(pb, 0), m * 4);
+		else pbc_div_core(m, S0, a, k, D0, D1), t = D0, D0 = D1, D1 = t;
+		memcpy(S0, pbf_get_S(pb, 0), m * 4);
+	}
+	if (s->pass == 2 && is_last) ibd_scan(s, &p->out, p->end, S0, D0, 0);
+	if (s->pass == 1) p->D1 = D0, D0 = 0;
+	free(S0); free(D0); free(D1);
+	pbf_close(pb);
+}
+
+static void *ibd_worker(void *data)
+{
+	ibd_shared_t *s = (ibd_shared_t*)data;
+	for (;;) {
+		int i, n = s->pass == 1? s->n_parts - 1 : s->n_parts;
+		pthread_mutex_lock(&s->lock);
+		i = s->next++;
+		pthread_mutex_unlock(&s->lock);
+		if (i >= n) break;
+		ibd_part(s, &s->parts[i], i == s->n_parts - 1);
+	}
+	return 0;
+}
+
+// D at the beginning of part p+1 from D at p and D at the end of p (with matches starting at the beginning of p)
+static void ibd_stitch(int m, const ibd_part_t *p, ibd_part_t *q)
+{
+	int i, j, n_lv;
+	int32_t *inv, **rmq;
+	for (n_lv = 1; 1<<n_lv <= m; ++n_lv);
+	rmq = (int32_t**)calloc(n_lv, sizeof(int32_t*));
+	rmq[0] = p->D;
+	for (j = 1; j < n_lv; ++j) { // sparse table: rmq[j][i] = max(D[i..i+2^j))
+		rmq[j] = (int32_t*)malloc(m * 4);
+		for (i = 0; i + (1<<j) <= m; ++i)
+			rmq[j][i] = rmq[j-1][i] > rmq[j-1][i + (1<<(j-1))]? rmq[j-1][i] : rmq[j-1][i + (1<<(j-1))];
+	}
+	inv = (int32_t*)malloc(m * 4);
+	for (i = 0; i < m; ++i) inv[p->S[i]] = i;
+	q->D = (int32_t*)malloc(m * 4);
+	q->D[0] = q->beg;
+	for (i = 1; i < m; ++i) {
+		int x, y, lv;
+		if (p->D1[i] > p->beg) {
+			q->D[i] = p->D1[i];
+			continue;
+		}
+		x = inv[q->S[i-1]], y = inv[q->S[i]];
+		if (x > y) lv = x, x = y, y = lv;
+		++x; // max(D[x+1..y])
+		for (lv = 0; 1<<(lv+1) <= y - x + 1; ++lv);
+		q->D[i] = rmq[lv][x] > rmq[lv][y - (1<<lv) + 1]? rmq[lv][x] : rmq[lv][y - (1<<lv) + 1];
+	}
+	for (j = 1; j < n_lv; ++j) free(rmq[j]);
+	free(rmq); free(inv);
+}
+
+static void ibd_run(ibd_shared_t *s, int n_threads)
+{
+	int i, n_seg, shift = pbf_get_shift(s->bf->pb);
+	int64_t k;
+	pthread_t *tid;
+	n_seg = ((s->row_end - 1) >> shift) - (s->row_beg >> shift) + 1;
+	s->n_parts = n_threads < n_seg? n_threads : n_seg;
+	s->parts = (ibd_part_t*)calloc(s->n_parts, sizeof(ibd_part_t));
+	for (i = 0, k = s->row_beg; i < s->n_parts; ++i) { // parts begin at checkpoints, except the first
+		ibd_part_t *p = &s->parts[i];
+		p->beg = k;
+		k = i == s->n_parts - 1? s->row_end : ((s->row_beg >> shift) + (int64_t)n_seg * (i + 1) / s->n_parts) << shift;
+		p->end = k;
+	}
+	tid = (pthread_t*)calloc(n_threads, sizeof(pthread_t));
+	for (s->pass = s->has_div || s->n_parts == 1? 2 : 1; s->pass <= 2; ++s->pass) {
+		if (s->pass == 2 && !s->has_div) { // stitch D at part boundaries
+			s->parts[0].D = (int32_t*)malloc(s->n_hap * 4);
+			for (i = 0; i < s->n_hap; ++i) s->parts[0].D[i] = s->row_beg;
+			for (i = 0; i < s->n_parts - 1; ++i)
+				ibd_stitch(s->n_hap, &s->parts[i], &s->parts[i+1]);
+		}
+		s->next = 0;
+		for (i = 0; i < s->n_parts; ++i) pthread_create(&tid[i], 0, ibd_worker, s);
+		for (i = 0; i < s->n_parts; ++i) pthread_join(tid[i], 0);
+	}
+	for (i = 0; i < s->n_parts; ++i) {
+		ibd_part_t *p = &s->parts[i];
+		if (p->out.l) fwrite(p->out.s, 1, p->out.l, stdout);
+		free(p->out.s); free(p->S); free(p->D); free(p->D1);
+	}
+	free(s->parts); free(tid);
+}
+
+int main_ibd(int argc, char *argv[])
+{
+	int c, n_threads = 1, n_pos = 0, m_pos = 0;
+	int64_t row, last_row = -1;
+	char *reg = 0;
+	bgt_file_t *bf;
+	bgt_t *bgt;
+	ibd_shared_t s;
+	int32_t *pos = 0;
+
+	memset(&s, 0, sizeof(ibd_shared_t));
+	s.L = 1000;
+	while ((c = getopt(argc, argv, "r:L:b:t:")) >= 0) {
+		if (c == 'r') reg = optarg;
+		else if (c == 'L') s.L = atoi(optarg);
+		else if (c == 'b') s.Lbp = atoi(optarg);
+		else if (c == 't') n_threads = atoi(optarg);
+	}
+	if (optind == argc) {
+		fprintf(stderr, "Usage: bgt ibd [options] <bgt-prefix>\n");
+		fprintf(stderr, "Options:\n");
+		fprintf(stderr, "  -r STR     region [all]\n");
+		fprintf(stderr, "  -L INT     report matches of INT or more sites [%d]\n", s.L);
+		fprintf(stderr, "  -b INT     report matches of INT or more bp (override -L) []\n");
+		fprintf(stderr, "  -t INT     number of threads [%d]\n", n_threads);
+		fprintf(stderr, "Output: sample1:hap, sample2:hap, chr, first pos, last pos, #sites\n");
+		return 1;
+	}
+	if (s.L < 1) s.L = 1;
+	if (n_threads < 1) n_threads = 1;
+
+	if ((bf = bgt_open(argv[optind])) == 0) {
+		fprintf(stderr, "[E::%s] failed to open BGT with prefix '%s'\n", __func__, argv[optind]);
+		return 1;
+	}
+	bgt = bgt_reader_init(bf);
+	if (reg && bgt_set_region(bgt, reg) < 0) {
+		fprintf(stderr, "[E::%s] failed to set region. Region format error?\n", __func__);
+		return 1;
+	}
+	s.bf = bf, s.n_hap = bf->f->n_rows * 2, s.rid = -1;
+	s.fn = (char*)malloc(strlen(bf->prefix) + 5);
+	sprintf(s.fn, "%s.pbf", bf->prefix);
+	pthread_mutex_init(&s.lock, 0);
+	{ // test if divergence arrays are present
+		pbf_t *pb = pbf_open_r_shared(s.fn, bf->pb);
+		s.has_div = (pbf_set_div(pb) == 0);
+		pbf_close(pb);
+	}
+
+	for (;;) { // collect positions of a contig and then find matches
+		row = bgt_read_core(bgt);
+		if (row < 0 || bgt->b0->rid != s.rid || row != last_row + 1) {
+			if (n_pos > 0) {
+				s.row_end = last_row + 1, s.pos = pos;
+				ibd_run(&s, n_threads);
+			}
+			if (row < 0) break;
+			s.rid = bgt->b0->rid, s.row_beg = row, n_pos = 0;
+		}
+		if (n_pos == m_pos) {
+			m_pos = m_pos? m_pos<<1 : 1024;
+			pos = (int32_t*)realloc(pos, m_pos * 4);
+		}
+		pos[n_pos++] = bgt->b0->pos;
+		last_row = row;
+	}
+
+	pthread_mutex_destroy(&s.lock);
+	free(pos); free(s.fn);
+	bgt_reader_destroy(bgt);
+	bgt_close(bf);
+	return 0;
+}
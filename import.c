@@ -4,10 +4,12 @@
 #include <stdio.h>
 #include "atomic.h"
 #include "pbwt.h"
+#include "bgzf.h"
+#include "bgt.h"
 
 int main_import(int argc, char *argv[])
 {
-	int i, j, c, clevel = -1, flag = 0, id_GT = -1, gen_pb1 = 0;
+	int i, j, c, clevel = -1, flag = 0, id_GT = -1, gen_pb1 = 0, n_threads = 0, shift = 13, keep_div = 0, sparse = 0, build_sdx = 0;
 	char *fn_ref = 0, moder[8], modew[8];
 	char *prefix, *fn;
 	uint8_t *bits[2], *bit1;
@@ -19,13 +21,18 @@ int main_import(int argc, char *argv[])
 	bcf_atombuf_t *ab;
 	const bcf_atom_t *a;
 
-	while ((c = getopt(argc, argv, "1l:SFt:")) >= 0) {
+	while ((c = getopt(argc, argv, "1l:SFt:@:k:Dc:I")) >= 0) {
 		switch (c) {
+		case '@': n_threads = atoi(optarg); break;
 		case '1': gen_pb1 = 1; break;
 		case 'l': clevel = atoi(optarg); flag |= 2; break;
 		case 'S': flag |= 1; break;
 		case 't': fn_ref = optarg; flag |= 1; break;
 		case 'F': flag |= 4; break;
+		case 'k': shift = atoi(optarg); break;
+		case 'D': keep_div = 1; break;
+		case 'c': sparse = atoi(optarg); break;
+		case 'I': build_sdx = 1; break;
 		}
 	}
 	if (argc - optind < 2) {
@@ -34,16 +41,27 @@ int main_import(int argc, char *argv[])
 		fprintf(stderr, "  -S           input is VCF\n");
 		fprintf(stderr, "  -t FILE      list of reference names and lengths [null]\n");
 		fprintf(stderr, "  -F           keep filtered variants\n");
+		fprintf(stderr, "  -@ INT       number of threads for BGZF decompression and compression [0]\n");
+		fprintf(stderr, "  -k INT       keep a PBWT checkpoint every 2^INT sites; 0 to choose from the data [%d]\n", shift);
+		fprintf(stderr, "  -D           keep PBWT divergence arrays at checkpoints (used by 'match')\n");
+		fprintf(stderr, "  -c INT       store ALT carriers of sites with <INT ALT alleles as lists; 0 to disable [%d]\n", sparse);
+		fprintf(stderr, "  -I           build the sample index (see 'smpidx')\n");
 		fprintf(stderr, "  -1           generate .pb1 file (not used for now)\n");
 		return 1;
 	}
+	if (shift > 30) shift = 30;
 	prefix = argv[optind];
 	fn = (char*)malloc(strlen(prefix) + 9);
+	sprintf(fn, "%s.jdx", prefix);
+	unlink(fn); // the join index of old data at the same prefix would be stale
+	sprintf(fn, "%s.sdx", prefix);
+	if (!build_sdx) unlink(fn); // so is the sample index; with -I, it is rebuilt below
 	strcpy(moder, "r");
 	if ((flag&1) == 0) strcat(moder, "b");
 
 	in = hts_open(argv[optind+1], moder, fn_ref);
 	assert(in);
+	if (n_threads > 0 && in->is_bin) bgzf_mt((BGZF*)in->fp, n_threads, 4);
 	ab = bcf_atombuf_init(in, flag&4);
 	assert(ab->h->n[BCF_DT_SAMPLE] > 0);
 	h0 = bcf_hdr_subset(ab->h, 0, 0, 0);
@@ -65,13 +83,15 @@ int main_import(int argc, char *argv[])
 
 	// prepare PBF to write
 	sprintf(fn, "%s.pbf", prefix);
-	pb = pbf_open_w(fn, ab->h->n[BCF_DT_SAMPLE]*2, 2, 13);
+	pb = pbf_open_w(fn, ab->h->n[BCF_DT_SAMPLE]*2, 2, shift);
+	if (keep_div) pbf_set_div(pb);
+	pbf_set_sparse(pb, sparse);
 	bits[0] = (uint8_t*)calloc(ab->h->n[BCF_DT_SAMPLE]*2, 1);
 	bits[1] = (uint8_t*)calloc(ab->h->n[BCF_DT_SAMPLE]*2, 1);
 
 	if (gen_pb1) {
 		sprintf(fn, "%s.pb1", prefix);
-		pb1 = pbf_open_w(fn, ab->h->n[BCF_DT_SAMPLE]*2, 1, 13);
+		pb1 = pbf_open_w(fn, ab->h->n[BCF_DT_SAMPLE]*2, 1, shift);
 	}
 	bit1 = (uint8_t*)calloc(ab->h->n[BCF_DT_SAMPLE]*2, 1);
 
@@ -80,12 +100,14 @@ int main_import(int argc, char *argv[])
 	if (clevel >= 0 && clevel <= 9) sprintf(modew + 2, "%d", clevel);
 	sprintf(fn, "%s.bcf", prefix);
 	out = hts_open(fn, modew, 0);
+	if (n_threads > 1) bgzf_mt((BGZF*)out->fp, n_threads, 256);
 	vcf_hdr_write(out, h0);
 
 	for (j = optind + 1; j < argc; ++j) {
 		bcf1_t *b;
 		if (j != optind + 1) { // the first file has already been opened
 			in = hts_open(argv[j], moder, fn_ref);
+			if (n_threads > 0 && in->is_bin) bgzf_mt((BGZF*)in->fp, n_threads, 4);
 			ab = bcf_atombuf_init(in, flag&4);
 		}
 		b = bcf_init1();
@@ -116,6 +138,10 @@ int main_import(int argc, char *argv[])
 
 	bcf_index_build(fn, 14);
 	free(fn);
+	if (build_sdx && bgt_sdx_build(prefix) < 0) {
+		fprintf(stderr, "[E::%s] failed to build the sample index\n", __func__);
+		return 1;
+	}
 	return 0;
 }
 
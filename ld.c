@@ -0,0 +1,207 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <pthread.h>
+#include "bgt.h"
+
+/* Haplotypes of each sample group are packed into 64-bit words, one set of
+ * words for the ALT allele and one for called haplotypes (those not missing
+ * according to the second bit plane). For a pair of sites, only haplotypes
+ * called at both sites are counted, with four popcounts per word. Sites are
+ * kept in a sliding window; each batch of new sites is split among threads
+ * and compared to all sites in the window before them. */
+
+#define LD_BATCH 4096
+
+typedef struct {
+	int rid, pos;
+	char *al;    // REF and ALT, TAB delimited
+	uint64_t *x; // ALT bits in n_words words, followed by called bits in n_words words
+} ld_site_t;
+
+typedef struct {
+	int n_groups, n_words, win_bp, win_site;
+	int g_off[BGT_MAX_GROUPS+1]; // words of group g: [g_off[g],g_off[g+1])
+	double min_r2;
+	const bcf_hdr_t *h;
+	int n, m;
+	ld_site_t *a; // sites in the window and the new batch
+} ld_aux_t;
+
+typedef struct {
+	const ld_aux_t *aux;
+	int beg, end; // new sites [beg,end)
+	kstring_t out;
+} ld_worker_t;
+
+static inline int ld_in_win(const ld_aux_t *aux, int i, int j) // whether site i is in the window of site j>i
+{
+	const ld_site_t *p = &aux->a[i], *q = &aux->a[j];
+	if (p->rid != q->rid) return 0;
+	return aux->win_site > 0? j - i <= aux->win_site : q->pos - p->pos <= aux->win_bp;
+}
+
+static void ld_pair(const ld_aux_t *aux, kstring_t *out, const ld_site_t *p, const ld_site_t *q)
+{
+	int g, w, nw = aux->n_words;
+	for (g = 0; g < aux->n_groups; ++g) {
+		int n = 0, c1 = 0, c2 = 0, c12 = 0;
+		double p1, p2, D, Dmax, r2;
+		for (w = aux->g_off[g]; w < aux->g_off[g+1]; ++w) {
+			uint64_t a1 = p->x[w], v1 = p->x[nw + w], a2 = q->x[w], v2 = q->x[nw + w];
+			n += bgt_popcnt64(v1 & v2);
+			c1 += bgt_popcnt64(a1 & v2);
+			c2 += bgt_popcnt64(a2 & v1);
+			c12 += bgt_popcnt64(a1 & a2);
+		}
+		if (n == 0 || c1 == 0 || c1 == n || c2 == 0 || c2 == n) continue;
+		p1 = (double)c1 / n, p2 = (double)c2 / n;
+		D = (double)c12 / n - p1 * p2;
+		r2 = D * D / (p1 * (1. - p1) * p2 * (1. - p2));
+		if (r2 < aux->min_r2) continue;
+		if (D < 0.) Dmax = p1 * p2 < (1. - p1) * (1. - p2)? p1 * p2 : (1. - p1) * (1. - p2);
+		else Dmax = p1 * (1. - p2) < (1. - p1) * p2? p1 * (1. - p2) : (1. - p1) * p2;
+		ksprintf(out, "%s\t%d\t%s\t%d\t%s\t%d\t%d\t%.4f\t%.4f\n", aux->h->id[BCF_DT_CTG][p->rid].key, p->pos + 1, p->al,
+				 q->pos + 1, q->al, g + 1, n, r2, D / Dmax);
+	}
+}
+
+static void *ld_worker(void *data)
+{
+	ld_worker_t *w = (ld_worker_t*)data;
+	int i, j;
+	for (j = w->beg; j < w->end; ++j) {
+		for (i = j - 1; i >= 0 && ld_in_win(w->aux, i, j); --i);
+		for (++i; i < j; ++i)
+			ld_pair(w->aux, &w->out, &w->aux->a[i], &w->aux->a[j]);
+	}
+	return 0;
+}
+
+static void ld_batch(ld_aux_t *aux, int first, int n_threads)
+{
+	int i, j;
+	pthread_t *tid;
+	ld_worker_t *w;
+	if (aux->n == first) return;
+	tid = (pthread_t*)calloc(n_threads, sizeof(pthread_t));
+	w = (ld_worker_t*)calloc(n_threads, sizeof(ld_worker_t));
+	for (i = 0; i < n_threads; ++i) {
+		w[i].aux = aux;
+		w[i].beg = first + (int64_t)(aux->n - first) * i / n_threads;
+		w[i].end = first + (int64_t)(aux->n - first) * (i + 1) / n_threads;
+		pthread_create(&tid[i], 0, ld_worker, &w[i]);
+	}
+	for (i = 0; i < n_threads; ++i) {
+		pthread_join(tid[i], 0);
+		if (w[i].out.l) fwrite(w[i].out.s, 1, w[i].out.l, stdout);
+		free(w[i].out.s);
+	}
+	free(w); free(tid);
+	for (i = 0; i < aux->n - 1 && !ld_in_win(aux, i, aux->n - 1); ++i) // sites no longer in any window
+		free(aux->a[i].al), free(aux->a[i].x);
+	for (j = i; j < aux->n; ++j) aux->a[j - i] = aux->a[j];
+	aux->n -= i;
+}
+
+int main_ld(int argc, char *argv[])
+{
+	int i, c, n_threads = 1, n_groups = 0, *hap_word = 0;
+	uint64_t *hap_bit = 0;
+	char *reg = 0, *gexpr[BGT_MAX_GROUPS];
+	bgt_file_t *bf;
+	bgt_t *bgt;
+	bgt_rec_t r;
+	ld_aux_t aux;
+
+	memset(&aux, 0, sizeof(ld_aux_t));
+	aux.win_bp = 100000, aux.min_r2 = 0.2;
+	while ((c = getopt(argc, argv, "s:r:w:W:m:t:")) >= 0) {
+		if (c == 's' && n_groups < BGT_MAX_GROUPS) gexpr[n_groups++] = optarg;
+		else if (c == 'r') reg = optarg;
+		else if (c == 'w') aux.win_bp = atoi(optarg);
+		else if (c == 'W') aux.win_site = atoi(optarg);
+		else if (c == 'm') aux.min_r2 = atof(optarg);
+		else if (c == 't') n_threads = atoi(optarg);
+	}
+	if (optind == argc) {
+		fprintf(stderr, "Usage: bgt ld [options] <bgt-prefix>\n");
+		fprintf(stderr, "Options:\n");
+		fprintf(stderr, "  -s EXPR    samples list (,sample1,sample2 or a file or expression); LD is computed per group [all]\n");
+		fprintf(stderr, "  -r STR     region [all]\n");
+		fprintf(stderr, "  -w INT     window size in bp [%d]\n", aux.win_bp);
+		fprintf(stderr, "  -W INT     window size in sites (override -w) []\n");
+		fprintf(stderr, "  -m FLOAT   min r^2 [%g]\n", aux.min_r2);
+		fprintf(stderr, "  -t INT     number of threads [%d]\n", n_threads);
+		fprintf(stderr, "Output: chr, pos1, ref1, alt1, pos2, ref2, alt2, group, #called haplotypes, r^2, D'\n");
+		return 1;
+	}
+	if (n_threads < 1) n_threads = 1;
+
+	if ((bf = bgt_open(argv[optind])) == 0) {
+		fprintf(stderr, "[E::%s] failed to open BGT with prefix '%s'\n", __func__, argv[optind]);
+		return 1;
+	}
+	bgt = bgt_reader_init(bf);
+	for (i = 0; i < n_groups; ++i) {
+		if (bgt_add_group(bgt, gexpr[i]) < 0) {
+			fprintf(stderr, "[E::%s] failed to add sample group '%s'.\n", __func__, gexpr[i]);
+			return 1;
+		}
+	}
+	if (reg && bgt_set_region(bgt, reg) < 0) {
+		fprintf(stderr, "[E::%s] failed to set region. Region format error?\n", __func__);
+		return 1;
+	}
+	bgt_prepare(bgt);
+	aux.h = bf->h0, aux.n_groups = bgt->n_groups;
+
+	{ // the word and the bit of each haplotype
+		int cnt[BGT_MAX_GROUPS];
+		memset(cnt, 0, sizeof(cnt));
+		for (i = 0; i < bgt->n_out; ++i) cnt[bgt->group[i] - 1] += 2;
+		for (i = 0; i < aux.n_groups; ++i)
+			aux.g_off[i+1] = aux.g_off[i] + (cnt[i] + 63) / 64;
+		aux.n_words = aux.g_off[aux.n_groups];
+		hap_word = (int*)malloc(bgt->n_out * 2 * sizeof(int));
+		hap_bit = (uint64_t*)malloc(bgt->n_out * 2 * 8);
+		memset(cnt, 0, sizeof(cnt));
+		for (i = 0; i < bgt->n_out * 2; ++i) {
+			int g = bgt->group[i>>1] - 1;
+			hap_word[i] = aux.g_off[g] + cnt[g] / 64;
+			hap_bit[i] = 1ULL << (cnt[g] % 64);
+			++cnt[g];
+		}
+	}
+
+	for (;;) { // read a batch of sites and compare each to sites in its window
+		int first = aux.n, ret = 0;
+		while (aux.n - first < LD_BATCH && (ret = bgt_read_rec(bgt, &r)) >= 0) {
+			ld_site_t *p;
+			kstring_t s = {0,0,0};
+			bcf_unpack((bcf1_t*)r.b0, BCF_UN_STR);
+			if (aux.n == aux.m) {
+				aux.m = aux.m? aux.m<<1 : 1024;
+				aux.a = (ld_site_t*)realloc(aux.a, aux.m * sizeof(ld_site_t));
+			}
+			p = &aux.a[aux.n++];
+			p->rid = r.b0->rid, p->pos = r.b0->pos;
+			ksprintf(&s, "%s\t%s", r.b0->d.allele[0], r.b0->n_allele > 1? r.b0->d.allele[1] : ".");
+			p->al = s.s;
+			p->x = (uint64_t*)calloc(aux.n_words * 2, 8);
+			for (i = 0; i < bgt->n_out * 2; ++i) {
+				if (r.a[0][i] && !r.a[1][i]) p->x[hap_word[i]] |= hap_bit[i];
+				if (!(r.a[1][i] && !r.a[0][i])) p->x[aux.n_words + hap_word[i]] |= hap_bit[i];
+			}
+		}
+		ld_batch(&aux, first, n_threads);
+		if (ret < 0) break;
+	}
+
+	for (i = 0; i < aux.n; ++i) free(aux.a[i].al), free(aux.a[i].x);
+	free(aux.a); free(hap_word); free(hap_bit);
+	bgt_reader_destroy(bgt);
+	bgt_close(bf);
+	return 0;
+}
@@ -11,6 +11,15 @@ int main_getalt(int argc, char *argv[]);
 int main_bcfidx(int argc, char *argv[]);
 int main_fmf(int argc, char *argv[]);
 int main_atomize(int argc, char *argv[]);
+int main_annidx(int argc, char *argv[]);
+int main_smpidx(int argc, char *argv[]);
+int main_simulate(int argc, char *argv[]);
+int main_match(int argc, char *argv[]);
+int main_ibd(int argc, char *argv[]);
+int main_ld(int argc, char *argv[]);
+int main_stats(int argc, char *argv[]);
+int main_sample_stats(int argc, char *argv[]);
+int main_grm(int argc, char *argv[]);
 
 static int usage()
 {
@@ -21,6 +30,15 @@ static int usage()
 	fprintf(stderr, "  view         extract from BGT\n");
 	fprintf(stderr, "  fmf          manipulate FMF files\n");
 	fprintf(stderr, "  bcfidx       (re)index BCF with record number index\n");
+	fprintf(stderr, "  annidx       index variant annotations against BGT sites\n");
+	fprintf(stderr, "  smpidx       index sites where each sample has an ALT allele\n");
+	fprintf(stderr, "  match        find haplotype matches to a query with PBWT\n");
+	fprintf(stderr, "  ibd          find long matches between all pairs of haplotypes\n");
+	fprintf(stderr, "  ld           compute pairwise LD in sliding windows\n");
+	fprintf(stderr, "  stats        compute SFS, diversity and Fst in windows\n");
+	fprintf(stderr, "  sample-stats per-sample genotype counts\n");
+	fprintf(stderr, "  grm          compute the KING kinship matrix\n");
+	fprintf(stderr, "  simulate     simulate genotypes of a synthetic cohort\n");
 	fprintf(stderr, "  version      show version number\n");
 	return 1;
 }
@@ -34,6 +52,15 @@ int main(int argc, char *argv[])
 	else if (strcmp(argv[1], "fmf") == 0 ) return main_fmf(argc-1, argv+1);
 	else if (strcmp(argv[1], "getalt") == 0) return main_getalt(argc-1, argv+1);
 	else if (strcmp(argv[1], "bcfidx") == 0) return main_bcfidx(argc-1, argv+1);
+	else if (strcmp(argv[1], "annidx") == 0) return main_annidx(argc-1, argv+1);
+	else if (strcmp(argv[1], "smpidx") == 0) return main_smpidx(argc-1, argv+1);
+	else if (strcmp(argv[1], "simulate") == 0) return main_simulate(argc-1, argv+1);
+	else if (strcmp(argv[1], "match") == 0) return main_match(argc-1, argv+1);
+	else if (strcmp(argv[1], "ibd") == 0) return main_ibd(argc-1, argv+1);
+	else if (strcmp(argv[1], "ld") == 0) return main_ld(argc-1, argv+1);
+	else if (strcmp(argv[1], "stats") == 0) return main_stats(argc-1, argv+1);
+	else if (strcmp(argv[1], "sample-stats") == 0) return main_sample_stats(argc-1, argv+1);
+	else if (strcmp(argv[1], "grm") == 0) return main_grm(argc-1, argv+1);
 	else if (strcmp(argv[1], "version") == 0) {
 		puts(BGT_VERSION);
 		return 0;
@@ -0,0 +1,260 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include "bgt.h"
+#include "atomic.h"
+#include "khash.h"
+KHASH_MAP_INIT_STR(qal, int)
+
+/* A query haplotype is compared to each panel haplotype h, keeping s[h], the
+ * first row of the current match. Two haplotypes match at a row if their 2-bit
+ * codes a[1]<<1|a[0] are identical, such that a missing genotype only matches
+ * a missing genotype, the same as in the divergence arrays, which are computed
+ * on both bit planes. When h mismatches at row k, the match [s[h],k) ends.
+ * With -L, matches of at least -L sites are reported. Without -L, a match is
+ * reported if no other match contains it, which is the set-maximal match of
+ * Durbin (2014). Each row takes O(M) time for M panel haplotypes, the same as
+ * decoding the row, so a query is linear in sites.
+ *
+ * Matches are cut at the start of the region unless the query is a panel
+ * haplotype and the PBF has divergence arrays (bgt import -D). In that case,
+ * the match start at the first site is the maximum divergence between the
+ * query and the panel haplotype in the PBWT order. */
+
+typedef struct {
+	int n_hap, L;
+	const fmf_t *f;
+	const bcf_hdr_t *h;
+	bgt_t *bgt2; // for finding the position of a row before the region
+	int64_t row0, last_row2;
+	int n_pos, m_pos, rid, last_pos2;
+	int32_t *pos; // pos[i]: position of row row0+i
+} mt_aux_t;
+
+typedef struct {
+	char *name;
+	int hap;   // 1 or 2
+	int self;  // haplotype index in the panel; -1 if not in the panel
+	int64_t *s;
+} mt_query_t;
+
+static int mt_row2pos(mt_aux_t *aux, int64_t row)
+{
+	if (row >= aux->row0) return aux->pos[row - aux->row0];
+	if (row == aux->last_row2) return aux->last_pos2;
+	bgt_set_start(aux->bgt2, row);
+	if (bgt_read_core(aux->bgt2) < 0) return -1;
+	aux->last_row2 = row, aux->last_pos2 = aux->bgt2->b0->pos;
+	return aux->last_pos2;
+}
+
+static void mt_print(mt_aux_t *aux, const mt_query_t *q, int h, int64_t beg, int64_t end) // [beg,end) in rows
+{
+	printf("%s:%d\t%s:%d\t%s\t%d\t%d\t%lld\n", q->name, q->hap, aux->f->rows[h>>1].name, (h&1) + 1,
+		   aux->h->id[BCF_DT_CTG][aux->rid].key, mt_row2pos(aux, beg) + 1, mt_row2pos(aux, end - 1) + 1, (long long)(end - beg));
+}
+
+// initialize s[] at the first row of a contig
+static void mt_init(mt_aux_t *aux, mt_query_t *q, pbf_t *pb, int64_t k, const uint8_t *c, int z)
+{
+	int h, g, j, pq;
+	for (h = 0; h < aux->n_hap; ++h)
+		q->s[h] = c[h] == z? k : k + 1;
+	if (q->self < 0 || pbf_get_div(pb, 0) == 0) return;
+	for (h = 0; h < aux->n_hap; ++h) q->s[h] = 0;
+	for (g = 0; g < 2; ++g) { // the match start is the max divergence between the two haplotypes in the PBWT order
+		const int32_t *S = pbf_get_S(pb, g), *D = pbf_get_div(pb, g);
+		int32_t cur;
+		for (pq = 0; pq < aux->n_hap && S[pq] != q->self; ++pq);
+		for (j = pq + 1, cur = 0; j < aux->n_hap; ++j) {
+			if (D[j] > cur) cur = D[j];
+			if (q->s[S[j]] < cur) q->s[S[j]] = cur;
+		}
+		for (j = pq - 1, cur = D[pq]; j >= 0; --j) {
+			if (q->s[S[j]] < cur) q->s[S[j]] = cur;
+			if (D[j] > cur) cur = D[j];
+		}
+	}
+}
+
+// process row k; z is the query allele; all matches end if c is NULL
+static void mt_step(mt_aux_t *aux, mt_query_t *q, int64_t k, const uint8_t *c, int z)
+{
+	int h;
+	int64_t *s = q->s;
+	if (aux->L > 0) {
+		for (h = 0; h < aux->n_hap; ++h) {
+			if (h == q->self || (c && c[h] == z)) continue;
+			if (k - s[h] >= aux->L) mt_print(aux, q, h, s[h], k);
+			s[h] = k + 1;
+		}
+	} else {
+		int64_t min_cont = k, min_end = k;
+		for (h = 0; h < aux->n_hap; ++h) {
+			if (h == q->self) continue;
+			if (c && c[h] == z) {
+				if (s[h] < min_cont) min_cont = s[h];
+			} else if (s[h] < min_end) min_end = s[h];
+		}
+		for (h = 0; h < aux->n_hap; ++h) {
+			if (h == q->self || (c && c[h] == z)) continue;
+			if (s[h] == min_end && min_end < min_cont) mt_print(aux, q, h, s[h], k);
+			s[h] = k + 1;
+		}
+	}
+}
+
+static khash_t(qal) *mt_read_query(const char *fn, int is_vcf, char **name)
+{
+	htsFile *in;
+	bcf_atombuf_t *ab;
+	const bcf_atom_t *a;
+	bcf1_t *b;
+	bgt_allele_t al;
+	kstring_t str = {0,0,0};
+	khash_t(qal) *h;
+
+	if ((in = hts_open(fn, is_vcf? "r" : "rb", 0)) == 0) return 0;
+	ab = bcf_atombuf_init(in, 0);
+	if (ab->h->n[BCF_DT_SAMPLE] == 0) {
+		bcf_atombuf_destroy(ab);
+		hts_close(in);
+		return 0;
+	}
+	*name = strdup(ab->h->id[BCF_DT_SAMPLE][0].key);
+	h = kh_init(qal);
+	b = bcf_init1();
+	memset(&al, 0, sizeof(bgt_allele_t));
+	while ((a = bcf_atom_read(ab)) != 0) {
+		khint_t k;
+		int absent;
+		bcf_atom2bcf(a, b, 1, -1);
+		bgt_al_from_bcf(ab->h, b, &al, 0);
+		bgt_al_format(&al, &str);
+		k = kh_put(qal, h, str.s, &absent);
+		if (absent) kh_key(h, k) = strdup(str.s);
+		kh_val(h, k) = a->gt[0] | (a->n_gt > 1? a->gt[1] : a->gt[0]) << 2;
+	}
+	free(al.chr.s); free(str.s);
+	bcf_destroy1(b);
+	bcf_atombuf_destroy(ab);
+	hts_close(in);
+	return h;
+}
+
+int main_match(int argc, char *argv[])
+{
+	int i, j, c, n_q = 2, is_vcf = 0;
+	int64_t row, last_row = -1;
+	char *reg = 0, *sample = 0, *fn_query = 0, *q_name = 0;
+	bgt_file_t *bf;
+	bgt_t *bgt;
+	bgt_rec_t r;
+	bgt_allele_t al;
+	kstring_t str = {0,0,0};
+	khash_t(qal) *hq = 0;
+	mt_aux_t aux;
+	mt_query_t q[2];
+	uint8_t *cd;
+
+	memset(&aux, 0, sizeof(mt_aux_t));
+	while ((c = getopt(argc, argv, "r:s:q:SL:")) >= 0) {
+		if (c == 'r') reg = optarg;
+		else if (c == 's') sample = optarg;
+		else if (c == 'q') fn_query = optarg;
+		else if (c == 'S') is_vcf = 1;
+		else if (c == 'L') aux.L = atoi(optarg);
+	}
+	if (optind == argc || (sample == 0) == (fn_query == 0)) {
+		fprintf(stderr, "Usage: bgt match [options] {-s sample | -q query.bcf} <bgt-prefix>\n");
+		fprintf(stderr, "Options:\n");
+		fprintf(stderr, "  -s STR     use haplotypes of sample STR in the panel as the query\n");
+		fprintf(stderr, "  -q FILE    use haplotypes of the first sample in BCF FILE as the query; missing sites are REF\n");
+		fprintf(stderr, "  -S         FILE of -q is VCF\n");
+		fprintf(stderr, "  -r STR     region [all]\n");
+		fprintf(stderr, "  -L INT     report matches of INT or more sites; 0 for set-maximal matches [%d]\n", aux.L);
+		fprintf(stderr, "Output: query:hap, sample:hap, chr, first pos, last pos, #sites\n");
+		return 1;
+	}
+
+	if ((bf = bgt_open(argv[optind])) == 0) {
+		fprintf(stderr, "[E::%s] failed to open BGT with prefix '%s'\n", __func__, argv[optind]);
+		return 1;
+	}
+	bgt = bgt_reader_init(bf);
+	aux.bgt2 = bgt_reader_init(bf);
+	aux.f = bf->f, aux.h = bf->h0, aux.n_hap = bf->f->n_rows * 2;
+	aux.rid = -1, aux.last_row2 = -1;
+	if (reg && bgt_set_region(bgt, reg) < 0) {
+		fprintf(stderr, "[E::%s] failed to set region. Region format error?\n", __func__);
+		return 1;
+	}
+	bgt_prepare(bgt);
+
+	for (j = 0; j < 2; ++j) q[j].self = -1, q[j].hap = j + 1;
+	if (sample) {
+		for (i = 0; i < bf->f->n_rows; ++i)
+			if (strcmp(bf->f->rows[i].name, sample) == 0) break;
+		if (i == bf->f->n_rows) {
+			fprintf(stderr, "[E::%s] sample '%s' is not in the panel\n", __func__, sample);
+			return 1;
+		}
+		for (j = 0; j < 2; ++j) q[j].self = i<<1 | j;
+		q_name = strdup(sample);
+		pbf_set_div(bgt->pb); // fine if divergence arrays are absent
+	} else if ((hq = mt_read_query(fn_query, is_vcf, &q_name)) == 0) {
+		fprintf(stderr, "[E::%s] failed to read sample genotypes from '%s'\n", __func__, fn_query);
+		return 1;
+	}
+	for (j = 0; j < n_q; ++j) {
+		q[j].name = q_name;
+		q[j].s = (int64_t*)calloc(aux.n_hap, 8);
+	}
+	cd = (uint8_t*)malloc(aux.n_hap);
+	memset(&al, 0, sizeof(bgt_allele_t));
+
+	while ((row = bgt_read_rec(bgt, &r)) >= 0) {
+		int z[2], first = 0;
+		if (r.b0->rid != aux.rid || row != last_row + 1) { // a new contig
+			if (aux.rid >= 0)
+				for (j = 0; j < n_q; ++j) mt_step(&aux, &q[j], last_row + 1, 0, 0);
+			aux.rid = r.b0->rid, aux.row0 = row, aux.n_pos = 0, first = 1;
+		}
+		if (aux.n_pos == aux.m_pos) {
+			aux.m_pos = aux.m_pos? aux.m_pos<<1 : 1024;
+			aux.pos = (int32_t*)realloc(aux.pos, aux.m_pos * 4);
+		}
+		aux.pos[aux.n_pos++] = r.b0->pos;
+		for (i = 0; i < aux.n_hap; ++i)
+			cd[i] = r.a[1][i]<<1 | r.a[0][i];
+		if (hq) {
+			khint_t k;
+			bgt_al_from_bcf(bf->h0, r.b0, &al, 0);
+			bgt_al_format(&al, &str);
+			k = kh_get(qal, hq, str.s);
+			z[0] = k == kh_end(hq)? 0 : kh_val(hq, k) & 3;
+			z[1] = k == kh_end(hq)? 0 : kh_val(hq, k) >> 2 & 3;
+		} else z[0] = cd[q[0].self], z[1] = cd[q[1].self];
+		for (j = 0; j < n_q; ++j) {
+			if (first) mt_init(&aux, &q[j], bgt->pb, row, cd, z[j]);
+			else mt_step(&aux, &q[j], row, cd, z[j]);
+		}
+		last_row = row;
+	}
+	if (aux.rid >= 0)
+		for (j = 0; j < n_q; ++j) mt_step(&aux, &q[j], last_row + 1, 0, 0);
+
+	if (hq) {
+		khint_t k;
+		for (k = 0; k < kh_end(hq); ++k)
+			if (kh_exist(hq, k)) free((char*)kh_key(hq, k));
+		kh_destroy(qal, hq);
+	}
+	for (j = 0; j < n_q; ++j) free(q[j].s);
+	free(q_name); free(cd); free(aux.pos); free(al.chr.s); free(str.s);
+	bgt_reader_destroy(aux.bgt2);
+	bgt_reader_destroy(bgt);
+	bgt_close(bf);
+	return 0;
+}
@@ -0,0 +1,265 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include "pbwt.h"
+
+static double cputime(void) // in ns
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int parse_list(const char *s, int *a, int max)
+{
+	int n = 0;
+	char *p;
+	while (n < max) {
+		a[n++] = strtol(s, &p, 10);
+		if (*p != ',') break;
+		s = p + 1;
+	}
+	return n;
+}
+
+static int parse_list_f(const char *s, double *a, int max)
+{
+	int n = 0;
+	char *p;
+	while (n < max) {
+		a[n++] = strtod(s, &p);
+		if (*p != ',') break;
+		s = p + 1;
+	}
+	return n;
+}
+
+// haplotypes copying 32 founders; a founder carries the ALT allele with probability af
+static uint8_t **gen_matrix(int m, int n, double af, int seed)
+{
+	int i, j, f[32], fdr[32], *cur;
+	uint8_t **a;
+	srand48(seed);
+	a = (uint8_t**)calloc(n, sizeof(uint8_t*));
+	cur = (int*)calloc(m, sizeof(int));
+	for (i = 0; i < m; ++i) cur[i] = (int)(drand48() * 32);
+	for (j = 0; j < 32; ++j) fdr[j] = j;
+	for (j = 0; j < n; ++j) {
+		a[j] = (uint8_t*)calloc(m, 1);
+		for (i = 0; i < 32; ++i) f[fdr[i]] = drand48() < af;
+		for (i = 0; i < m; ++i) {
+			if (drand48() < 0.01) cur[i] = (int)(drand48() * 32); // recombination
+			a[j][i] = f[cur[i]] ^ (drand48() < 0.001);
+		}
+	}
+	free(cur);
+	return a;
+}
+
+static uint8_t **load_matrix(const char *fn, int *m, int *n)
+{
+	pbf_t *pb;
+	const uint8_t **r;
+	uint8_t **a = 0;
+	int k = 0, max = 0;
+	if ((pb = pbf_open_r(fn)) == 0) return 0;
+	*m = pbf_get_m(pb);
+	while (k < *n && (r = pbf_read(pb)) != 0) {
+		if (k == max) {
+			max = max? max<<1 : 256;
+			a = (uint8_t**)realloc(a, max * sizeof(uint8_t*));
+		}
+		a[k] = (uint8_t*)malloc(*m);
+		memcpy(a[k++], r[0], *m);
+	}
+	pbf_close(pb);
+	*n = k;
+	return a;
+}
+
+static long write_pbf(const char *fn, int m, int n, uint8_t *const*a, int shift, int sparse) // return the file size
+{
+	pbf_t *pb;
+	FILE *fp;
+	long sz;
+	int r;
+	if ((pb = pbf_open_w(fn, m, 1, shift)) == 0) return -1;
+	pbf_set_sparse(pb, sparse);
+	for (r = 0; r < n; ++r) pbf_write(pb, &a[r]);
+	pbf_close(pb);
+	if ((fp = fopen(fn, "rb")) == 0) return -1;
+	fseek(fp, 0, SEEK_END);
+	sz = ftell(fp);
+	fclose(fp);
+	return sz;
+}
+
+static void print1(const char *kernel, int m, int n_sub, int shift, const char *af, double t, int n, double bytes)
+{
+	printf("%s\t%d\t%d\t%d\t%s\t%.1f\t%.3f\n", kernel, m, n_sub, shift, af, t / n, bytes / t);
+}
+
+int main(int argc, char *argv[])
+{
+	int c, i, j, k, n = 1000, n_seek = 200, seed = 11, sparse = 0;
+	int n_m = 3, ms[16] = { 1000, 10000, 100000 }, n_ns = 3, ns[16] = { 10, 100, 1000 }, n_sh = 2, shs[16] = { 8, 13 }, n_af = 2;
+	double afs[16] = { 0.01, 0.2 };
+	char *fn_in = 0, *fn_tmp = "pbfbench.tmp.pbf", af_str[32];
+
+	while ((c = getopt(argc, argv, "m:u:s:a:n:k:i:t:x:c:")) >= 0) {
+		if (c == 'm') n_m = parse_list(optarg, ms, 16);
+		else if (c == 'u') n_ns = parse_list(optarg, ns, 16);
+		else if (c == 's') n_sh = parse_list(optarg, shs, 16);
+		else if (c == 'a') n_af = parse_list_f(optarg, afs, 16);
+		else if (c == 'n') n = atoi(optarg);
+		else if (c == 'k') n_seek = atoi(optarg);
+		else if (c == 'i') fn_in = optarg;
+		else if (c == 't') fn_tmp = optarg;
+		else if (c == 'x') seed = atoi(optarg);
+		else if (c == 'c') sparse = atoi(optarg);
+	}
+	if (argc > optind || n <= 0) {
+		fprintf(stderr, "Usage: pbfbench [options]\n");
+		fprintf(stderr, "Options:\n");
+		fprintf(stderr, "  -m INT,...   numbers of columns [1000,10000,100000]\n");
+		fprintf(stderr, "  -u INT,...   numbers of columns decoded by pbs_dec/pbs_skip/pbf_rsub [10,100,1000]\n");
+		fprintf(stderr, "  -s INT,...   checkpoint intervals (as shift) for pbf_seek; the first also for pbf_read/pbf_rsub [8,13]\n");
+		fprintf(stderr, "  -c INT       write rows with <INT 1 bits as sparse rows in PBF (see pbf_set_sparse) [%d]\n", sparse);
+		fprintf(stderr, "  -a FLOAT,... ALT allele frequencies of simulated matrices [0.01,0.2]\n");
+		fprintf(stderr, "  -n INT       number of rows [%d]\n", n);
+		fprintf(stderr, "  -k INT       number of random seeks [%d]\n", n_seek);
+		fprintf(stderr, "  -i FILE      use the first group of rows in PBF FILE instead of simulating (override -m/-a) []\n");
+		fprintf(stderr, "  -t FILE      temporary PBF for pbf_seek [%s]\n", fn_tmp);
+		fprintf(stderr, "  -x INT       random seed [%d]\n", seed);
+		fprintf(stderr, "Output: kernel, m, n_sub, shift, AF, ns per row (per seek+read for pbf_seek), GB/s of the 0/1 array\n");
+		return 1;
+	}
+	if (fn_in) n_m = n_af = 1;
+
+	for (i = 0; i < n_m; ++i) {
+		for (j = 0; j < n_af; ++j) {
+			int m = ms[i], r, l_tot = 0;
+			uint8_t **a, **enc;
+			pbc_t *pc;
+			double t;
+			if (fn_in) {
+				if ((a = load_matrix(fn_in, &m, &n)) == 0) {
+					fprintf(stderr, "[E::%s] failed to read PBF file '%s'\n", __func__, fn_in);
+					return 1;
+				}
+				strcpy(af_str, "file");
+			} else {
+				a = gen_matrix(m, n, afs[j], seed);
+				snprintf(af_str, sizeof(af_str), "%g", afs[j]);
+			}
+
+			// pbc_enc
+			pc = pbc_init(m);
+			enc = (uint8_t**)calloc(n, sizeof(uint8_t*));
+			t = cputime();
+			for (r = 0; r < n; ++r) pbc_enc(pc, a[r]);
+			t = cputime() - t;
+			print1("pbc_enc", m, m, 0, af_str, t, n, (double)m * n);
+			free(pc);
+			pc = pbc_init(m);
+			for (r = 0; r < n; ++r) { // keep the encoded rows
+				pbc_enc(pc, a[r]);
+				enc[r] = (uint8_t*)malloc(pc->l + 1);
+				memcpy(enc[r], pc->u, pc->l);
+				enc[r][pc->l] = 0;
+				l_tot += pc->l;
+			}
+			free(pc);
+			fprintf(stderr, "[M::%s] m=%d, AF=%s: %.2f bytes per encoded row\n", __func__, m, af_str, (double)l_tot / n);
+
+			// pbc_dec
+			pc = pbc_init(m);
+			t = cputime();
+			for (r = 0; r < n; ++r) pbc_dec(pc, enc[r]);
+			t = cputime() - t;
+			print1("pbc_dec", m, m, 0, af_str, t, n, (double)m * n);
+			free(pc);
+
+			// pbs_dec
+			for (k = 0; k < n_ns; ++k) {
+				int n_sub = ns[k] < m? ns[k] : m;
+				pbs_dat_t *sub, *d1;
+				uint8_t *b;
+				if (n_sub <= 0) continue;
+				sub = (pbs_dat_t*)calloc(n_sub, sizeof(pbs_dat_t));
+				d1 = (pbs_dat_t*)calloc(n_sub, sizeof(pbs_dat_t));
+				b = (uint8_t*)calloc(n_sub, 1);
+				for (r = 0; r < n_sub; ++r) // evenly spaced columns; S is the identity before the first row
+					sub[r].i = r, sub[r].r = (int64_t)r * m / n_sub;
+				t = cputime();
+				for (r = 0; r < n; ++r) pbs_dec(m, n_sub, sub, enc[r], b);
+				t = cputime() - t;
+				print1("pbs_dec", m, n_sub, 0, af_str, t, n, (double)n_sub * n);
+				for (r = 0; r < n_sub; ++r)
+					sub[r].i = r, sub[r].r = (int64_t)r * m / n_sub;
+				t = cputime();
+				for (r = 0; r < n; ++r) pbs_dec_core(m, n_sub, sub, enc[r], 0, d1); // rank-only, as in pbf_seek()
+				t = cputime() - t;
+				print1("pbs_skip", m, n_sub, 0, af_str, t, n, (double)n_sub * n);
+				free(sub); free(d1); free(b);
+			}
+
+			// pbf_read and pbf_rsub: sequential reads of all or a subset of columns
+			if (n_sh > 0) {
+				pbf_t *pb;
+				long sz;
+				if ((sz = write_pbf(fn_tmp, m, n, a, shs[0], sparse)) < 0) {
+					fprintf(stderr, "[E::%s] failed to write to file '%s'\n", __func__, fn_tmp);
+					return 1;
+				}
+				fprintf(stderr, "[M::%s] m=%d, AF=%s, shift=%d, sparse<%d: %ld bytes in PBF\n", __func__, m, af_str, shs[0], sparse, sz);
+				pb = pbf_open_r(fn_tmp);
+				t = cputime();
+				for (r = 0; r < n; ++r) pbf_read(pb);
+				t = cputime() - t;
+				print1("pbf_read", m, m, shs[0], af_str, t, n, (double)m * n);
+				pbf_close(pb);
+				for (k = 0; k < n_ns; ++k) {
+					int n_sub = ns[k] < m? ns[k] : m, *sub;
+					if (n_sub <= 0) continue;
+					sub = (int*)calloc(n_sub, sizeof(int));
+					for (r = 0; r < n_sub; ++r) sub[r] = (int64_t)r * m / n_sub;
+					pb = pbf_open_r(fn_tmp);
+					pbf_subset(pb, n_sub, sub);
+					t = cputime();
+					for (r = 0; r < n; ++r) pbf_read(pb);
+					t = cputime() - t;
+					print1("pbf_rsub", m, n_sub, shs[0], af_str, t, n, (double)n_sub * n);
+					pbf_close(pb);
+					free(sub);
+				}
+			}
+
+			// pbf_seek
+			for (k = 0; k < n_sh; ++k) {
+				pbf_t *pb;
+				if (write_pbf(fn_tmp, m, n, a, shs[k], sparse) < 0) {
+					fprintf(stderr, "[E::%s] failed to write to file '%s'\n", __func__, fn_tmp);
+					return 1;
+				}
+				pb = pbf_open_r(fn_tmp);
+				srand48(seed);
+				t = cputime();
+				for (r = 0; r < n_seek; ++r) {
+					pbf_seek(pb, (int64_t)(drand48() * n));
+					pbf_read(pb);
+				}
+				t = cputime() - t;
+				print1("pbf_seek", m, m, shs[k], af_str, t, n_seek, (double)m * n_seek);
+				pbf_close(pb);
+				unlink(fn_tmp);
+			}
+
+			for (r = 0; r < n; ++r) free(a[r]), free(enc[r]);
+			free(a); free(enc);
+		}
+	}
+	return 0;
+}
@@ -29,7 +29,7 @@ int main(int argc, char *argv[])
 		fprintf(stderr, "Options:\n");
 		fprintf(stderr, "  -S       input is PIM (portable integer matrix format)\n");
 		fprintf(stderr, "  -b       output PBF (positional BWT format)\n");
-		fprintf(stderr, "  -s INT   write S array every 1<<INT rows (effective with -b) [%d]\n", shift);
+		fprintf(stderr, "  -s INT   write S array every 1<<INT rows; 0 for auto (effective with -b) [%d]\n", shift);
 		fprintf(stderr, "  -r INT   start decoding from row INT (effective w/o -S) [0]\n");
 		fprintf(stderr, "  -n INT   read INT rows starting from -r (effective w/o -S) [inf]\n");
 		fprintf(stderr, "  -c INT   decode column INT (there can be multiple -c; effective w/o -S) [inf]\n");
@@ -89,6 +89,21 @@ void pbc_dec_core(int m, const int32_t *S0, const uint8_t *u, int32_t *S, uint8_
 	}
 }
 
+// Given S_{k-1}, A_k and D_{k-1}, derive D_k (Durbin 2014, Algorithm 2). D[i] is the first row of the match between S[i-1] and S[i]
+void pbc_div_core(int m, const int32_t *S0, const uint8_t *a, int32_t k, const int32_t *D0, int32_t *D)
+{
+	int32_t j, n0, p = k + 1, q = k + 1, *x[2];
+	for (j = n0 = 0; j < m; ++j)
+		n0 += !a[S0[j]];
+	x[0] = D, x[1] = D + n0;
+	for (j = 0; j < m; ++j) {
+		if (D0[j] > p) p = D0[j];
+		if (D0[j] > q) q = D0[j];
+		if (!a[S0[j]]) *x[0]++ = p, p = 0;
+		else *x[1]++ = q, q = 0;
+	}
+}
+
 pbc_t *pbc_init(int m)
 {
 	int j;
@@ -126,24 +141,23 @@ void pbc_dec(pbc_t *pb, const uint8_t *b)
 #define pbs_key_r(x) ((x).r)
 KRADIX_SORT_INIT(r, pbs_dat_t, pbs_key_r, 4)
 
-void pbs_dec(int m, int r, pbs_dat_t *d, const uint8_t *u, uint8_t *a) // IMPORTANT: d MUST BE sorted by d[i].r
+void pbs_dec_core(int m, int r, pbs_dat_t *d, const uint8_t *u, uint8_t *a, pbs_dat_t *d1) // IMPORTANT: d MUST BE sorted by d[i].r
 {
 	const uint8_t *q;
 	int n1;
 	for (q = u, n1 = 0; *q; ++q) // count the number of 1 bits
 		if (*q&1) n1 += pbr_tbl[*q>>1];
 	if (n1 == 0) { // all zero
-		memset(a, 0, r);
+		if (a) memset(a, 0, r);
 	} else if (n1 == m) { // all one
-		memset(a, 1, r);
+		if (a) memset(a, 1, r);
 	} else {
-		pbs_dat_t *p = d, *end = d + r, *d1, *x[2];
+		pbs_dat_t *p = d, *end = d + r, *x[2];
 		int c[2], acc[2];
 		acc[0] = 0, acc[1] = m - n1; // accumulative counts
 		c[0] = c[1] = 0; // running marginal counts
-		d1 = (pbs_dat_t*)malloc(r * sizeof(pbs_dat_t));
 		x[0] = d, x[1] = d1;
-		memset(a, 0, r);
+		if (a) memset(a, 0, r);
 		for (q = u; p != end && *q; ++q) {
 			int l = pbr_tbl[*q>>1], b = *q&1, s = c[0] + c[1];
 			if (s <= p->r && p->r < s + l) {
@@ -159,20 +173,116 @@ void pbs_dec(int m, int r, pbs_dat_t *d, const uint8_t *u, uint8_t *a) // IMPORT
 				} else {
 					memcpy(x[1], p0, (p - p0) * sizeof(pbs_dat_t));
 					x[1] += p - p0;
-					while (p0 < p) a[p0->i] = 1, ++p0;
+					if (a) for (; p0 < p; ++p0) a[p0->i] = 1;
 				}
 			}
 			c[b] += l;
 		}
 		memcpy(x[0], d1, (x[1] - d1) * sizeof(pbs_dat_t));
-		free(d1);
 	}
 }
 
+void pbs_dec(int m, int r, pbs_dat_t *d, const uint8_t *u, uint8_t *a)
+{
+	pbs_dat_t *d1;
+	d1 = (pbs_dat_t*)malloc(r * sizeof(pbs_dat_t));
+	pbs_dec_core(m, r, d, u, a, d1);
+	free(d1);
+}
+
+/***************
+ * Sparse rows *
+ ***************/
+
+/* A sparse row lists the ranks in S_{k-1} of columns with bit 1, in place of
+ * the RLE string. It starts with a zero byte, which never starts an RLE
+ * string, followed by differences between adjacent ranks (the first rank for
+ * the first) as little-endian base-128 varints. S_k is derived as in
+ * pbc_enc_core(): listed columns are moved to the end, in order. Decoding
+ * walks the list, not the runs. */
+
+// Given S_{k-1} and A_k, write the sparse row to $u and return its length. $u MUST be at least 1+5*n1 long.
+static int pbp_enc(int m, const int32_t *S0, const uint8_t *a, uint8_t *u)
+{
+	int32_t j, last = 0;
+	uint8_t *p = u;
+	*p++ = 0;
+	for (j = 0; j < m; ++j) {
+		if (a[S0[j]]) {
+			p = pb_put_varint(p, j - last);
+			last = j;
+		}
+	}
+	return p - u;
+}
+
+static inline int32_t pbp_count(const uint8_t *u, int l) // number of 1 bits
+{
+	int32_t i, n1;
+	for (i = 1, n1 = 0; i < l; ++i)
+		n1 += !(u[i]&0x80);
+	return n1;
+}
+
+// Given S_{k-1} and a sparse row of length $l, derive A_k and S_k
+static void pbp_dec(int m, const int32_t *S0, const uint8_t *u, int l, int32_t *S, uint8_t *a)
+{
+	const uint8_t *q = u + 1, *end = u + l;
+	int32_t r = 0, s = 0, *p0 = S, *p1 = S + (m - pbp_count(u, l));
+	memset(a, 0, m);
+	while (q < end) {
+		uint64_t x;
+		q = pb_get_varint(q, &x);
+		r += x;
+		memcpy(p0, &S0[s], (r - s) * 4);
+		p0 += r - s;
+		*p1++ = S0[r];
+		a[S0[r]] = 1;
+		s = r + 1;
+	}
+	memcpy(p0, &S0[s], (m - s) * 4);
+}
+
+// Same as pbs_dec_core() but for a sparse row of length $l
+static void pbp_dec_sub(int m, int n_sub, pbs_dat_t *d, const uint8_t *u, int l, uint8_t *a, pbs_dat_t *d1)
+{
+	const uint8_t *q = u + 1, *end = u + l;
+	pbs_dat_t *p = d, *p0, *end_d = d + n_sub, *x[2];
+	uint32_t c, r = 0, n1;
+	if (a) memset(a, 0, n_sub);
+	if ((n1 = pbp_count(u, l)) == 0) return;
+	x[0] = d, x[1] = d1;
+	for (c = 0; q < end && p != end_d; ++c) { // $r is the rank of the c-th 1 bit
+		uint64_t y;
+		q = pb_get_varint(q, &y);
+		r = c? r + y : y;
+		for (p0 = p; p != end_d && p->r < r; ++p) p->r -= c;
+		if (x[0] != p0) memmove(x[0], p0, (p - p0) * sizeof(pbs_dat_t));
+		x[0] += p - p0;
+		if (p != end_d && p->r == r) {
+			p->r = m - n1 + c;
+			if (a) a[p->i] = 1;
+			*x[1]++ = *p++;
+		}
+	}
+	for (p0 = p; p != end_d; ++p) p->r -= c;
+	if (x[0] != p0) memmove(x[0], p0, (p - p0) * sizeof(pbs_dat_t));
+	x[0] += p - p0;
+	memcpy(x[0], d1, (x[1] - d1) * sizeof(pbs_dat_t));
+}
+
 /************
  * File I/O *
  ************/
 
+#define PBF_AUTO_MIN 8  // smallest shift chosen by auto shift
+#define PBF_AUTO_MAX 16 // largest shift chosen by auto shift
+#define PBF_AUTO_OVH 4  // S takes about 1/2^PBF_AUTO_OVH of the space of rows
+
+#ifndef kroundup32
+#define kroundup32(x) (--(x), (x)|=(x)>>1, (x)|=(x)>>2, (x)|=(x)>>4, (x)|=(x)>>8, (x)|=(x)>>16, ++(x))
+#endif
+
 struct pbf_s {
 	FILE *fp;   // PBF file handler
 	int32_t m;  // number of columns
@@ -184,23 +294,77 @@ struct pbf_s {
 	pbc_t **pb; // pbwt full codecs
 	const uint8_t **ret; // ret[g] points to pb[g]->u; this is for return (writing only)
 
-	int32_t n_idx, m_idx;
-	uint64_t *idx; // file offset of "S" records
+	int32_t n_idx, m_idx, idx_shared;
+	uint64_t *idx; // file offset of "S" records; owned by another handler if idx_shared is set
+	int64_t m_roff;
+	uint32_t *roff; // roff[k]: offset of the k-th row relative to the preceding "S"; shared with idx; NULL if absent
+
+	int32_t has_div, use_div; // "D" records are present; D is kept up to date
+	int32_t sparse_thres; // write a sparse row for a group with fewer 1 bits (writing only)
+	int32_t **D, **D0; // divergence arrays; D[g] is for the row just processed (writing or reading with use_div)
 
 	int n_sub;
 	pbs_dat_t **sub;
+	pbs_dat_t *sub_buf; // scratch space of pbs_dec_core()
 	int *sub_list;
 
+	int64_t l_seg; // bytes written since the last "S" (writing only)
+	int32_t l_pend, m_pend;
+	uint8_t *pend; // "B" records held before the header is written (auto shift only)
+
 	int64_t k;     // the row index just processed (reading only)
+	int64_t n_dec, n_ckpt; // rows decoded and checkpoints loaded (reading only)
+	int32_t m_seg;
+	uint8_t *seg;  // rows between a checkpoint and the target of pbf_seek() (reading only)
 	uint8_t *buf;  // reading only
 	int32_t *invS; // reading only
 };
 
+static void pbf_push_roff(pbf_t *pb, int64_t off)
+{
+	if (pb->m_roff < 0) return; // disabled due to overflow
+	if (off > UINT32_MAX) {
+		free(pb->roff);
+		pb->roff = 0, pb->m_roff = -1;
+		return;
+	}
+	if (pb->n == pb->m_roff) {
+		pb->m_roff = pb->m_roff? pb->m_roff<<1 : 1024;
+		pb->roff = (uint32_t*)realloc(pb->roff, pb->m_roff * 4);
+	}
+	pb->roff[pb->n] = off;
+}
+
+static inline void pbf_update_div(pbf_t *pb, int g, const int32_t *S0, const uint8_t *a)
+{
+	int32_t *swap;
+	if (!pb->use_div) return;
+	swap = pb->D0[g], pb->D0[g] = pb->D[g], pb->D[g] = swap;
+	pbc_div_core(pb->m, S0, a, pb->is_writing? pb->n : pb->k, pb->D0[g], pb->D[g]);
+}
+
+static int64_t pbf_write_div(pbf_t *pb, const int32_t *const*D)
+{
+	int g;
+	fputc('D', pb->fp);
+	for (g = 0; g < pb->g; ++g)
+		fwrite(D[g], 4, pb->m, pb->fp);
+	return 1 + (int64_t)pb->m * 4 * pb->g;
+}
+
+static void pbf_write_hdr(pbf_t *pb)
+{
+	int32_t v[3];
+	v[0] = pb->m, v[1] = pb->g, v[2] = pb->shift;
+	fwrite(pb->sparse_thres > 0? "PBF\2" : "PBF\1", 1, 4, pb->fp); // version 2 may have sparse rows
+	fwrite(v, 4, 3, pb->fp);
+}
+
 pbf_t *pbf_open_w(const char *fn, int m, int g, int shift)
 {
 	FILE *fp;
 	pbf_t *pb;
-	int32_t i, v[3];
+	int32_t i;
 	if (fn && strcmp(fn, "-") != 0) {
 		if ((fp = fopen(fn, "wb")) == NULL)
 			return 0;
@@ -211,14 +375,50 @@ pbf_t *pbf_open_w(const char *fn, int m, int g, int shift)
 	pb->pb = (pbc_t**)calloc(g, sizeof(void*));
 	for (i = 0; i < g; ++i)
 		pb->pb[i] = pbc_init(m);
-	v[0] = pb->m, v[1] = pb->g, v[2] = pb->shift;
-	fwrite("PBF\1", 1, 4, fp);
-	fwrite(v, 4, 3, fp);
+	if (shift <= 0) pb->shift = -1; // the header is written once the first 1<<PBF_AUTO_MIN rows are seen; otherwise before the first row
 	pb->is_writing = 1;
 	return pb;
 }
 
-pbf_t *pbf_open_r(const char *fn)
+/* With auto shift, the first rows are encoded into memory. The checkpoint
+ * interval is then chosen such that an S record takes about 1/2^PBF_AUTO_OVH
+ * of the space of the rows it covers, but no more than 1<<PBF_AUTO_MAX rows
+ * need to be replayed after a seek. Only S at row 0, the identity, falls in
+ * the buffered rows, as PBF_AUTO_MIN is the smallest interval allowed. */
+static void pbf_flush_pend(pbf_t *pb)
+{
+	int32_t g, j, *S0;
+	double l_row = pb->n? (double)pb->l_pend / pb->n : 1., l_ckpt = (double)pb->m * 4 * pb->g * (pb->has_div? 2 : 1);
+	for (pb->shift = PBF_AUTO_MIN; pb->shift < PBF_AUTO_MAX; ++pb->shift)
+		if (l_ckpt <= l_row * (1ULL<<pb->shift) / (1<<PBF_AUTO_OVH)) break;
+	pbf_write_hdr(pb);
+	if (pb->n > 0) {
+		S0 = (int32_t*)malloc(pb->m * 4);
+		for (j = 0; j < pb->m; ++j) S0[j] = j;
+		pb->idx = (uint64_t*)calloc(pb->m_idx = 8, 8);
+		pb->idx[pb->n_idx++] = ftell(pb->fp);
+		fputc('S', pb->fp);
+		for (g = 0; g < pb->g; ++g)
+			fwrite(S0, 4, pb->m, pb->fp);
+		pb->l_seg = 1 + (int64_t)pb->m * 4 * pb->g;
+		if (pb->has_div) { // all zero before the first row
+			memset(S0, 0, pb->m * 4);
+			fputc('D', pb->fp);
+			for (g = 0; g < pb->g; ++g)
+				fwrite(S0, 4, pb->m, pb->fp);
+			pb->l_seg += 1 + (int64_t)pb->m * 4 * pb->g;
+		}
+		fwrite(pb->pend, 1, pb->l_pend, pb->fp);
+		free(S0);
+		for (j = 0; j < pb->n && pb->roff; ++j)
+			pb->roff[j] += pb->l_seg;
+		pb->l_seg += pb->l_pend;
+	}
+	free(pb->pend);
+	pb->pend = 0, pb->l_pend = pb->m_pend = 0;
+}
+
+static pbf_t *pbf_open_r_core(const char *fn, const pbf_t *ref)
 {
 	pbf_t *pb;
 	FILE *fp;
@@ -229,12 +429,11 @@ pbf_t *pbf_open_r(const char *fn)
 			return 0;
 	} else fp = stdin;
 	fread(magic, 1, 4, fp);
-	if (strncmp(magic, "PBF\1", 4) != 0) {
+	if (strncmp(magic, "PBF", 3) != 0 || magic[3] < 1 || magic[3] > 2 || fread(v, 4, 3, fp) != 3 || (ref && (v[0] != ref->m || v[1] != ref->g || v[2] != ref->shift))) {
 		fclose(fp);
 		return 0;
 	}
 	pb = (pbf_t*)calloc(1, sizeof(pbf_t));
-	fread(v, 4, 3, fp);
 	pb->m = v[0], pb->g = v[1], pb->shift = v[2];
 	pb->pb = (pbc_t**)calloc(pb->g, sizeof(void*));
 	for (i = 0; i < pb->g; ++i)
@@ -244,8 +443,12 @@ pbf_t *pbf_open_r(const char *fn)
 	pb->ret = (const uint8_t**)calloc(pb->g, sizeof(uint8_t*));
 	for (i = 0; i < pb->g; ++i) pb->ret[i] = pb->pb[i]->u;
 	pb->sub = (pbs_dat_t**)calloc(pb->g, sizeof(pbs_dat_t*));
-	if (fseek(fp, -8, SEEK_END) >= 0) {
+	if (ref) { // share the index
+		pb->n = ref->n, pb->n_idx = pb->m_idx = ref->n_idx, pb->has_div = ref->has_div;
+		pb->idx = ref->idx, pb->roff = ref->roff, pb->idx_shared = 1;
+	} else if (fseek(fp, -8, SEEK_END) >= 0) {
 		uint64_t off;
+		long end = ftell(fp);
 		uint8_t t;
 		fread(&off, 8, 1, fp);
 		fseek(fp, off, SEEK_SET);
@@ -255,16 +458,35 @@ pbf_t *pbf_open_r(const char *fn)
 		pb->m_idx = pb->n_idx;
 		pb->idx = (uint64_t*)calloc(pb->n_idx, 8);
 		fread(pb->idx, 8, pb->n_idx, fp);
+		if (ftell(fp) + pb->n * 4 == end) { // per-row offsets are present
+			pb->roff = (uint32_t*)malloc(pb->n * 4 + 1);
+			if (fread(pb->roff, 4, pb->n, fp) != (size_t)pb->n)
+				free(pb->roff), pb->roff = 0;
+		}
+		if (pb->n_idx > 0) { // test if "D" follows the first "S"
+			fseek(fp, pb->idx[0] + 1 + (int64_t)pb->m * 4 * pb->g, SEEK_SET);
+			pb->has_div = (fgetc(fp) == 'D');
+		}
 		fseek(fp, 16, SEEK_SET);
 	}
 	pb->fp = fp;
 	return pb;
 }
 
+pbf_t *pbf_open_r(const char *fn) { return pbf_open_r_core(fn, 0); }
+
+pbf_t *pbf_open_r_shared(const char *fn, const pbf_t *ref)
+{
+	if (ref == 0 || ref->is_writing) return 0;
+	return pbf_open_r_core(fn, ref);
+}
+
 int pbf_close(pbf_t *pb)
 {
 	int g;
 	if (pb == 0) return 0;
+	if (pb->is_writing && pb->shift < 0) pbf_flush_pend(pb);
+	else if (pb->is_writing && pb->n == 0) pbf_write_hdr(pb);
 	if (pb->is_writing) { // write the index
 		uint64_t off;
 		off = ftell(pb->fp);
@@ -272,23 +494,58 @@ int pbf_close(pbf_t *pb)
 		fwrite(&pb->n, 8, 1, pb->fp);
 		fwrite(&pb->n_idx, 4, 1, pb->fp);
 		fwrite(pb->idx, 8, pb->n_idx, pb->fp);
+		if (pb->roff) fwrite(pb->roff, 4, pb->n, pb->fp); // optional; absent in older files
 		fwrite(&off, 8, 1, pb->fp);
 	}
-	free(pb->idx); free(pb->ret); free(pb->invS); free(pb->buf); free(pb->sub_list);
+	if (!pb->idx_shared) free(pb->idx), free(pb->roff);
+	free(pb->ret); free(pb->invS); free(pb->buf); free(pb->seg); free(pb->sub_list); free(pb->sub_buf);
 	for (g = 0; g < pb->g; ++g) {
 		free(pb->pb[g]);
 		if (pb->sub) free(pb->sub[g]);
+		if (pb->D) free(pb->D[g]), free(pb->D0[g]);
 	}
+	free(pb->D); free(pb->D0);
 	free(pb->sub); free(pb->pb);
 	fclose(pb->fp);
 	free(pb);
 	return 0;
 }
 
+static void pbf_enc_row(pbf_t *pb, int g, const uint8_t *a)
+{
+	pbc_t *pbc = pb->pb[g];
+	int32_t j, n1;
+	pbc_enc(pbc, a);
+	if (pb->sparse_thres <= 0) return;
+	for (j = n1 = 0; j < pb->m; ++j) n1 += !!a[j];
+	if (n1 < pb->sparse_thres && 1 + 5 * n1 <= pb->m) // the sparse row fits in pbc->u
+		pbc->l = pbp_enc(pb->m, pbc->S0, a, pbc->u);
+}
+
 int pbf_write(pbf_t *pb, uint8_t *const*a)
 {
 	int g;
 	if (!pb->is_writing) return -1;
+	if (pb->shift < 0) { // auto shift: hold the row in memory
+		pbf_push_roff(pb, pb->l_pend); // the size of "S" is added in pbf_flush_pend()
+		for (g = 0; g < pb->g; ++g) {
+			pbc_t *pbc = pb->pb[g];
+			pbf_update_div(pb, g, pbc->S, a[g]);
+			pbf_enc_row(pb, g, a[g]);
+			if (pb->l_pend + pbc->l + 5 > pb->m_pend) {
+				pb->m_pend = pb->l_pend + pbc->l + 5;
+				kroundup32(pb->m_pend);
+				pb->pend = (uint8_t*)realloc(pb->pend, pb->m_pend);
+			}
+			if (g == 0) pb->pend[pb->l_pend++] = 'B';
+			memcpy(pb->pend + pb->l_pend, &pbc->l, 4);
+			memcpy(pb->pend + pb->l_pend + 4, pbc->u, pbc->l);
+			pb->l_pend += pbc->l + 4;
+		}
+		if (++pb->n == 1LL<<PBF_AUTO_MIN) pbf_flush_pend(pb);
+		return 0;
+	}
+	if (pb->n == 0) pbf_write_hdr(pb);
 	if ((pb->n & ((1ULL<<pb->shift) - 1)) == 0) {
 		if (pb->n_idx == pb->m_idx) {
 			pb->m_idx = pb->m_idx? pb->m_idx<<1 : 8;
@@ -298,19 +555,52 @@ int pbf_write(pbf_t *pb, uint8_t *const*a)
 		fputc('S', pb->fp);
 		for (g = 0; g < pb->g; ++g) // write S[]
 			fwrite(pb->pb[g]->S, 4, pb->m, pb->fp);
+		pb->l_seg = 1 + (int64_t)pb->m * 4 * pb->g;
+		if (pb->has_div) pb->l_seg += pbf_write_div(pb, (const int32_t*const*)pb->D);
 	}
+	pbf_push_roff(pb, pb->l_seg);
 	fputc('B', pb->fp);
 	for (g = 0; g < pb->g; ++g) {
 		pbc_t *pbc = pb->pb[g];
-		pbc_enc(pbc, a[g]);
+		pbf_update_div(pb, g, pbc->S, a[g]);
+		pbf_enc_row(pb, g, a[g]);
 		fwrite(&pbc->l, 4, 1, pb->fp);
 		fwrite(pbc->u, 1, pbc->l, pb->fp);
+		pb->l_seg += 4 + pbc->l;
 	}
+	++pb->l_seg;
 	++pb->n;
 	return 0;
 }
 
-const uint8_t **pbf_read(pbf_t *pb)
+static void pbf_read_div(pbf_t *pb) // "D" has been read
+{
+	int g;
+	pb->has_div = 1;
+	if (pb->use_div) {
+		for (g = 0; g < pb->g; ++g)
+			fread(pb->D[g], 4, pb->m, pb->fp);
+	} else fseek(pb->fp, (long)pb->m * 4 * pb->g, SEEK_CUR);
+}
+
+static void pbf_dec_row(pbf_t *pb, int g, int32_t l, int skip) // decode pb->buf of length _l_
+{
+	pbc_t *pbc = pb->pb[g];
+	int sparse = (l > 0 && pb->buf[0] == 0);
+	if (pb->n_sub > 0 && pb->n_sub < pb->m) { // subset decoding
+		if (sparse) pbp_dec_sub(pb->m, pb->n_sub, pb->sub[g], pb->buf, l, skip? 0 : pbc->u, pb->sub_buf);
+		else pbs_dec_core(pb->m, pb->n_sub, pb->sub[g], pb->buf, skip? 0 : pbc->u, pb->sub_buf);
+	} else { // full decoding
+		if (sparse) {
+			int32_t *swap;
+			swap = pbc->S, pbc->S = pbc->S0, pbc->S0 = swap;
+			pbp_dec(pb->m, pbc->S0, pb->buf, l, pbc->S, pbc->u);
+		} else pbc_dec(pbc, pb->buf);
+		pbf_update_div(pb, g, pbc->S0, pbc->u);
+	}
+}
+
+static const uint8_t **pbf_read_core(pbf_t *pb, int skip) // with _skip_, subset decoding only updates ranks
 {
 	int g;
 	uint8_t t;
@@ -320,6 +610,10 @@ const uint8_t **pbf_read(pbf_t *pb)
 		for (g = 0; g < pb->g; ++g)
 			fread(pb->pb[g]->S, 4, pb->m, pb->fp);
 		fread(&t, 1, 1, pb->fp);
+		if (t == 'D') {
+			pbf_read_div(pb);
+			fread(&t, 1, 1, pb->fp);
+		}
 	}
 	if (t == 'B') {
 		for (g = 0; g < pb->g; ++g) {
@@ -327,15 +621,15 @@ const uint8_t **pbf_read(pbf_t *pb)
 			fread(&l, 4, 1, pb->fp);
 			fread(pb->buf, 1, l, pb->fp);
 			pb->buf[l] = 0;
-			if (pb->n_sub > 0 && pb->n_sub < pb->m) // subset decoding
-				pbs_dec(pb->m, pb->n_sub, pb->sub[g], pb->buf, pb->pb[g]->u);
-			else pbc_dec(pb->pb[g], pb->buf); // full decoding
+			pbf_dec_row(pb, g, l, skip);
 		}
-		++pb->k;
+		++pb->k, ++pb->n_dec;
 	} else return 0;
 	return pb->ret;
 }
 
+const uint8_t **pbf_read(pbf_t *pb) { return pbf_read_core(pb, 0); }
+
 // find the rank of a subset of columns given S
 static inline void pbf_fill_sub(int m, const int32_t *S, int n_sub, pbs_dat_t *sub, int32_t *invS, int *sub_list)
 {
@@ -353,11 +647,12 @@ int pbf_seek(pbf_t *pb, uint64_t k)
 	if (pb->is_writing) return -1;
 	if (k == pb->k) return 0;
 	if (k > pb->k && k - pb->k <= 1<<pb->shift) {
-		while (pb->k < k) pbf_read(pb);
+		while (pb->k < k) pbf_read_core(pb, 1);
 		return 0;
 	}
 	if (pb->idx == 0 || k >= pb->n) return -1;
 	fseek(pb->fp, pb->idx[k>>pb->shift], SEEK_SET);
+	++pb->n_ckpt;
 	fread(&t, 1, 1, pb->fp);
 	assert(t == 'S'); // a bug or corrupted file if it is not an "S" line
 	for (g = 0; g < pb->g; ++g) {
@@ -365,9 +660,37 @@ int pbf_seek(pbf_t *pb, uint64_t k)
 		if (pb->n_sub > 0 && pb->n_sub < pb->m) // update pb->sub if needed
 			pbf_fill_sub(pb->m, pb->pb[g]->S, pb->n_sub, pb->sub[g], pb->invS, pb->sub_list);
 	}
+	if (pb->has_div) {
+		fread(&t, 1, 1, pb->fp);
+		assert(t == 'D');
+		pbf_read_div(pb);
+	}
 	pb->k = k >> pb->shift << pb->shift;
 	x = k & ((1<<pb->shift) - 1);
-	for (i = 0; i < x; ++i) pbf_read(pb);
+	if (x > 0 && pb->roff) { // read rows up to k in one go; update S or ranks only
+		int32_t l_seg = pb->roff[k] - pb->roff[pb->k];
+		const uint8_t *p;
+		if (l_seg + 1 > pb->m_seg) {
+			pb->m_seg = l_seg + 1;
+			kroundup32(pb->m_seg);
+			pb->seg = (uint8_t*)realloc(pb->seg, pb->m_seg);
+		}
+		if (fread(pb->seg, 1, l_seg, pb->fp) != (size_t)l_seg) return -1;
+		for (i = 0, p = pb->seg; i < x; ++i) {
+			assert(*p == 'B');
+			for (++p, g = 0; g < pb->g; ++g) {
+				int32_t l;
+				memcpy(&l, p, 4);
+				memcpy(pb->buf, p + 4, l);
+				pb->buf[l] = 0, p += 4 + l;
+				pbf_dec_row(pb, g, l, 1);
+			}
+			++pb->k;
+		}
+		pb->n_dec += x;
+	} else {
+		for (i = 0; i < x; ++i) pbf_read_core(pb, 1);
+	}
 	return 0;
 }
 
@@ -377,6 +700,7 @@ int pbf_subset(pbf_t *pb, int n_sub, int *sub)
 	if (n_sub <= 0 || n_sub >= pb->m || sub == 0) n_sub = 0;
 	if ((pb->n_sub = n_sub) != 0) {
 		pb->sub_list = (int*)realloc(pb->sub_list, n_sub * sizeof(int));
+		pb->sub_buf = (pbs_dat_t*)realloc(pb->sub_buf, n_sub * sizeof(pbs_dat_t));
 		memcpy(pb->sub_list, sub, n_sub * sizeof(int));
 		for (g = 0; g < pb->g; ++g) {
 			pb->sub[g] = (pbs_dat_t*)realloc(pb->sub[g], n_sub * sizeof(pbs_dat_t));
@@ -384,10 +708,41 @@ int pbf_subset(pbf_t *pb, int n_sub, int *sub)
 			pbf_fill_sub(pb->m, pb->pb[g]->S, n_sub, pb->sub[g], pb->invS, pb->sub_list);
 		}
 	}
+	if (pb->k > 0) pb->k = -1; // S is not updated by subset decoding; force pbf_seek() to reload a checkpoint
 	return 0;
 }
 
+int pbf_set_div(pbf_t *pb)
+{
+	int g;
+	if (pb->use_div) return 0;
+	if (pb->is_writing) {
+		if (pb->n > 0) return -1;
+		pb->has_div = 1;
+	} else if (!pb->has_div) return -1;
+	pb->D = (int32_t**)calloc(pb->g, sizeof(int32_t*));
+	pb->D0 = (int32_t**)calloc(pb->g, sizeof(int32_t*));
+	for (g = 0; g < pb->g; ++g) {
+		pb->D[g] = (int32_t*)calloc(pb->m, 4);
+		pb->D0[g] = (int32_t*)calloc(pb->m, 4);
+	}
+	pb->use_div = 1;
+	if (!pb->is_writing && pb->k > 0) pb->k = -1; // force pbf_seek() to load D from a checkpoint
+	return 0;
+}
+
+int pbf_set_sparse(pbf_t *pb, int thres)
+{
+	if (!pb->is_writing || pb->n > 0) return -1;
+	pb->sparse_thres = thres > 0? thres : 0;
+	return 0;
+}
+
+const int32_t *pbf_get_S(const pbf_t *pb, int g) { return pb->pb[g]->S; }
+const int32_t *pbf_get_div(const pbf_t *pb, int g) { return pb->use_div? pb->D[g] : 0; }
+
 int pbf_get_g(const pbf_t *pb) { return pb->g; }
 int pbf_get_m(const pbf_t *pb) { return pb->m; }
 int pbf_get_n(const pbf_t *pb) { return pb->n; }
 int pbf_get_shift(const pbf_t *pb) { return pb->shift; }
+void pbf_get_stat(const pbf_t *pb, int64_t *n_dec, int64_t *n_ckpt) { *n_dec = pb->n_dec, *n_ckpt = pb->n_ckpt; }
@@ -30,7 +30,9 @@ extern "C" {
  * @param fn     file name. NULL or "-" for stdout
  * @param m      number of columns
  * @param g      number of groups
- * @param shift  keeping S every 1<<shift rows
+ * @param shift  keeping S every 1<<shift rows; if non-positive, choose shift
+ *               from m and the size of the first encoded rows. The header is
+ *               not written until these rows are seen.
  */
 pbf_t *pbf_open_w(const char *fn, int m, int g, int shift);
 
@@ -41,6 +43,16 @@ pbf_t *pbf_open_w(const char *fn, int m, int g, int shift);
  */
 pbf_t *pbf_open_r(const char *fn);
 
+/**
+ * Open PBF for read, sharing the header and the index of an opened handler
+ *
+ * The index is not copied; _ref_ must not be closed before the new handler.
+ *
+ * @param fn     file name; must be the same file as _ref_
+ * @param ref    PBF handler opened by pbf_open_r()
+ */
+pbf_t *pbf_open_r_shared(const char *fn, const pbf_t *ref);
+
 /**
  * Close a PBF file handler and deallocate memory
  *
@@ -82,10 +94,54 @@ int pbf_seek(pbf_t *pb, uint64_t k);
  */
 int pbf_subset(pbf_t *fp, int n_sub, int *sub);
 
+/**
+ * Keep divergence arrays
+ *
+ * For writing, "D" records are written after each "S" record. This function
+ * must be called before the first pbf_write(). For reading, the file must
+ * have "D" records. Divergence arrays are only updated by full decoding, not
+ * after pbf_subset().
+ *
+ * @param pb     PBF file handler
+ * @return  0 on success; -1 if "D" records can't be written or are absent
+ */
+int pbf_set_div(pbf_t *pb);
+
+/**
+ * Write sparse rows for rare bits
+ *
+ * A group with fewer than _thres_ 1 bits in a row is written as the list of
+ * the ranks of these bits, instead of RLE. Such a row is decoded in time
+ * linear in the number of 1 bits, in addition to updating S. Files with
+ * sparse rows are not readable by older versions. This function must be
+ * called before the first pbf_write().
+ *
+ * @param pb     PBF file handler opened for writing
+ * @param thres  threshold; 0 to disable
+ * @return  0 on success; -1 if called too late
+ */
+int pbf_set_sparse(pbf_t *pb, int thres);
+
+/**
+ * Get the prefix array S and the divergence array D after the last row
+ *
+ * S[i] is the column at rank i. D[i] is the first row of the match between
+ * columns S[i-1] and S[i] that ends at the last row, or the next row if the
+ * two columns differ at the last row. D[0] is always the next row.
+ *
+ * @param pb     PBF file handler
+ * @param g      group
+ * @return  pointer to an array of m elements; pbf_get_div() returns NULL
+ *          if pbf_set_div() has not been called
+ */
+const int32_t *pbf_get_S(const pbf_t *pb, int g);
+const int32_t *pbf_get_div(const pbf_t *pb, int g);
+
 int pbf_get_g(const pbf_t *pb);
 int pbf_get_m(const pbf_t *pb);
 int pbf_get_n(const pbf_t *pb);
 int pbf_get_shift(const pbf_t *pb);
+void pbf_get_stat(const pbf_t *pb, int64_t *n_dec, int64_t *n_ckpt); // rows decoded and checkpoints loaded since opened
 
 /***********************
  * Low-level functions *
@@ -119,6 +175,18 @@ void pbc_enc(pbc_t *pb, const uint8_t *a);
  */
 void pbc_dec(pbc_t *pb, const uint8_t *b);
 
+/**
+ * Update the divergence array
+ *
+ * @param m    number of columns
+ * @param S0   S before row k
+ * @param a    bit string of row k
+ * @param k    row index
+ * @param D0   divergence array before row k
+ * @param D    divergence array after row k (output)
+ */
+void pbc_div_core(int m, const int32_t *S0, const uint8_t *a, int32_t k, const int32_t *D0, int32_t *D);
+
 /**
  * Decode a subset of columns without decoding all columns
  *
@@ -126,11 +194,36 @@ void pbc_dec(pbc_t *pb, const uint8_t *b);
  * @param n_sub   number of columns to decode
  * @param sub     S(sub[i].r)=sub[i].S gives the column index to decode
  * @param u       encoded string generated by pbc_enc()
+ * @param a       decoded bits of the n_sub columns; NULL to only update ranks
  */
 void pbs_dec(int m, int n_sub, pbs_dat_t *sub, const uint8_t *u, uint8_t *a);
 
+/**
+ * Same as pbs_dec() but with caller-provided scratch space
+ *
+ * @param d1      array of at least n_sub elements; no need to initialize
+ */
+void pbs_dec_core(int m, int n_sub, pbs_dat_t *sub, const uint8_t *u, uint8_t *a, pbs_dat_t *d1);
+
 #ifdef __cplusplus
 }
 #endif
 
+// little-endian base-128 varints, as used by sparse rows and the sample index
+static inline uint8_t *pb_put_varint(uint8_t *p, uint64_t x) // $p MUST have 10 bytes; return the end
+{
+	for (; x >= 0x80; x >>= 7) *p++ = (x&0x7f) | 0x80;
+	*p++ = x;
+	return p;
+}
+
+static inline const uint8_t *pb_get_varint(const uint8_t *p, uint64_t *x)
+{
+	int s;
+	for (*x = 0, s = 0; *p&0x80; ++p, s += 7)
+		*x |= (uint64_t)(*p&0x7f) << s;
+	*x |= (uint64_t)*p << s;
+	return p + 1;
+}
+
 #endif
@@ -0,0 +1,239 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include "vcf.h"
+#include "kstring.h"
+
+/* Genotypes are simulated with a mosaic model: each haplotype copies one of
+ * a few founders and switches to another founder with probability -r between
+ * adjacent sites. The ALT allele count at a site is drawn from the allele
+ * frequency spectrum. ALT alleles are placed on all haplotypes copying a
+ * random set of founders, such that haplotypes sharing a founder segment are
+ * in LD. An allele is then flipped with probability -e and a genotype is set
+ * missing with probability -M. */
+
+typedef struct {
+	int n_hap, n_fdr, n_pop;
+	double r_switch, r_flip, r_mis, mig;
+	int *fdr;   // fdr[i]: founder copied by haplotype i
+	int *cnt, *off, *hap; // haplotypes copying founder j: hap[off[j]] .. hap[off[j]+cnt[j]-1]
+	int *perm;
+	uint8_t *a; // allele on each haplotype
+	double *sfs; // cumulative distribution of the ALT allele count
+} sim_t;
+
+static int sim_draw_fdr(const sim_t *s, int hap)
+{
+	int pop, n;
+	if (s->n_pop == 1 || s->n_fdr < s->n_pop || drand48() < s->mig)
+		return (int)(drand48() * s->n_fdr);
+	pop = (hap>>1) % s->n_pop, n = s->n_fdr / s->n_pop; // founders are partitioned among populations
+	return pop * n + (int)(drand48() * n);
+}
+
+static void sim_init(sim_t *s, double alpha)
+{
+	int i;
+	double sum = 0.;
+	s->fdr = (int*)calloc(s->n_hap, sizeof(int));
+	s->hap = (int*)calloc(s->n_hap, sizeof(int));
+	s->cnt = (int*)calloc(s->n_fdr + 1, sizeof(int));
+	s->off = (int*)calloc(s->n_fdr + 1, sizeof(int));
+	s->perm = (int*)calloc(s->n_fdr > 0? s->n_fdr : 1, sizeof(int));
+	s->a = (uint8_t*)calloc(s->n_hap, 1);
+	s->sfs = (double*)calloc(s->n_hap, sizeof(double));
+	for (i = 1; i < s->n_hap; ++i)
+		s->sfs[i] = (sum += pow(i, -alpha));
+	for (i = 1; i < s->n_hap; ++i) s->sfs[i] /= sum;
+	for (i = 0; i < s->n_hap; ++i)
+		s->fdr[i] = s->n_fdr > 0? sim_draw_fdr(s, i) : 0;
+}
+
+static void sim_destroy(sim_t *s)
+{
+	free(s->fdr); free(s->hap); free(s->cnt); free(s->off); free(s->perm); free(s->a); free(s->sfs);
+}
+
+static int sim_draw_ac(const sim_t *s)
+{
+	double x = drand48();
+	int lo = 1, hi = s->n_hap - 1;
+	while (lo < hi) { // binary search for the smallest k such that sfs[k] >= x
+		int mid = (lo + hi) >> 1;
+		if (s->sfs[mid] < x) lo = mid + 1;
+		else hi = mid;
+	}
+	return lo;
+}
+
+static void sim_site(sim_t *s)
+{
+	int i, j, k, ac;
+	memset(s->a, 0, s->n_hap);
+	ac = sim_draw_ac(s);
+	if (s->n_fdr == 0) { // no LD; ALT alleles on a random set of haplotypes
+		for (i = 0; i < s->n_hap; ++i) s->hap[i] = i;
+		for (i = 0; i < ac; ++i) {
+			int t;
+			j = i + (int)(drand48() * (s->n_hap - i));
+			t = s->hap[i], s->hap[i] = s->hap[j], s->hap[j] = t;
+			s->a[s->hap[i]] = 1;
+		}
+	} else {
+		for (i = 0; i < s->n_hap; ++i) // recombination
+			if (drand48() < s->r_switch)
+				s->fdr[i] = sim_draw_fdr(s, i);
+		memset(s->cnt, 0, (s->n_fdr + 1) * sizeof(int));
+		for (i = 0; i < s->n_hap; ++i) ++s->cnt[s->fdr[i]];
+		for (j = 0, k = 0; j < s->n_fdr; ++j) s->off[j] = k, k += s->cnt[j];
+		for (i = 0; i < s->n_hap; ++i) s->hap[s->off[s->fdr[i]]++] = i;
+		for (j = 0; j < s->n_fdr; ++j) s->off[j] -= s->cnt[j];
+		for (j = 0; j < s->n_fdr; ++j) s->perm[j] = j;
+		for (j = 0; j < s->n_fdr && ac > 0; ++j) { // put ALT on haplotypes copying random founders
+			int t, f, *h;
+			k = j + (int)(drand48() * (s->n_fdr - j));
+			t = s->perm[j], s->perm[j] = s->perm[k], s->perm[k] = t;
+			f = s->perm[j], h = &s->hap[s->off[f]];
+			if (s->cnt[f] <= ac) {
+				for (i = 0; i < s->cnt[f]; ++i) s->a[h[i]] = 1;
+				ac -= s->cnt[f];
+			} else { // a new mutation on a founder segment
+				for (i = 0; i < ac; ++i) {
+					k = i + (int)(drand48() * (s->cnt[f] - i));
+					t = h[i], h[i] = h[k], h[k] = t;
+					s->a[h[i]] = 1;
+				}
+				ac = 0;
+			}
+		}
+	}
+	if (s->r_flip > 0.)
+		for (i = 0; i < s->n_hap; ++i)
+			if (drand48() < s->r_flip) s->a[i] ^= 1;
+}
+
+int main_simulate(int argc, char *argv[])
+{
+	int c, i, n_smpl = 100, dist = 100, bcf_out = 0, clevel = -1, seed = 11;
+	long k, n_site = 10000;
+	double alpha = 1.0;
+	char *chr = "1", *fn_spl = 0, modew[8];
+	kstring_t str = {0,0,0};
+	bcf_hdr_t *h = 0;
+	htsFile *out = 0;
+	bcf1_t *b = 0;
+	int64_t pos = 0;
+	sim_t s;
+
+	memset(&s, 0, sizeof(sim_t));
+	s.n_fdr = 32, s.n_pop = 1, s.r_switch = 0.01, s.r_flip = 0.0005, s.mig = 0.1;
+	while ((c = getopt(argc, argv, "n:m:c:d:a:f:r:e:M:p:S:x:bl:")) >= 0) {
+		if (c == 'n') n_smpl = atoi(optarg);
+		else if (c == 'm') n_site = atol(optarg);
+		else if (c == 'c') chr = optarg;
+		else if (c == 'd') dist = atoi(optarg);
+		else if (c == 'a') alpha = atof(optarg);
+		else if (c == 'f') s.n_fdr = atoi(optarg);
+		else if (c == 'r') s.r_switch = atof(optarg);
+		else if (c == 'e') s.r_flip = atof(optarg);
+		else if (c == 'M') s.r_mis = atof(optarg);
+		else if (c == 'p') s.n_pop = atoi(optarg);
+		else if (c == 'S') fn_spl = optarg;
+		else if (c == 'x') seed = atoi(optarg);
+		else if (c == 'b') bcf_out = 1;
+		else if (c == 'l') clevel = atoi(optarg);
+	}
+	if (argc == 1) {
+		fprintf(stderr, "Usage: bgt simulate [options]\n");
+		fprintf(stderr, "Options:\n");
+		fprintf(stderr, "  -n INT     number of samples [%d]\n", n_smpl);
+		fprintf(stderr, "  -m INT     number of sites [%ld]\n", n_site);
+		fprintf(stderr, "  -c STR     contig name [%s]\n", chr);
+		fprintf(stderr, "  -d INT     average distance between adjacent sites [%d]\n", dist);
+		fprintf(stderr, "  -a FLOAT   P(k ALT alleles) is proportional to k^{-FLOAT}; 1 for the neutral spectrum [%g]\n", alpha);
+		fprintf(stderr, "  -f INT     number of founder haplotypes; 0 for no LD [%d]\n", s.n_fdr);
+		fprintf(stderr, "  -r FLOAT   probability of switching founders between adjacent sites [%g]\n", s.r_switch);
+		fprintf(stderr, "  -e FLOAT   probability of flipping an allele [%g]\n", s.r_flip);
+		fprintf(stderr, "  -M FLOAT   fraction of missing genotypes [%g]\n", s.r_mis);
+		fprintf(stderr, "  -p INT     number of populations, each copying its own founders most of the time [%d]\n", s.n_pop);
+		fprintf(stderr, "  -S FILE    write sample populations in the FMF format to FILE (as prefix.spl for import) []\n");
+		fprintf(stderr, "  -x INT     random seed [%d]\n", seed);
+		fprintf(stderr, "  -b         BCF output\n");
+		fprintf(stderr, "  -l INT     compression level for BCF [default]\n");
+		return 1;
+	}
+	if (n_smpl < 1 || n_site < 1 || dist < 1 || s.n_fdr < 0 || s.n_pop < 1) {
+		fprintf(stderr, "[E::%s] -n, -m, -d and -p must be positive and -f non-negative.\n", __func__);
+		return 1;
+	}
+	if (clevel > 9) clevel = 9;
+	srand48(seed);
+	s.n_hap = n_smpl * 2;
+	sim_init(&s, alpha);
+
+	if (fn_spl) {
+		FILE *fp;
+		if ((fp = fopen(fn_spl, "w")) == 0) {
+			fprintf(stderr, "[E::%s] failed to write to file '%s'\n", __func__, fn_spl);
+			return 1;
+		}
+		for (i = 0; i < n_smpl; ++i)
+			fprintf(fp, "S%d\tpopulation:Z:P%d\n", i, i % s.n_pop);
+		fclose(fp);
+	}
+
+	// write the header
+	kputs("##fileformat=VCFv4.1\n", &str);
+	kputs("##FORMAT=<ID=GT,Number=1,Type=String,Description=\"Genotype\">\n", &str);
+	ksprintf(&str, "##contig=<ID=%s,length=%lld>\n", chr, (long long)(n_site + 1) * dist * 2);
+	kputs("#CHROM\tPOS\tID\tREF\tALT\tQUAL\tFILTER\tINFO\tFORMAT", &str);
+	for (i = 0; i < n_smpl; ++i) ksprintf(&str, "\tS%d", i);
+	if (bcf_out) {
+		h = bcf_hdr_init();
+		h->l_text = str.l + 1, h->text = str.s; // h takes the ownership of str.s
+		bcf_hdr_parse(h);
+		strcpy(modew, "wb");
+		if (clevel >= 0) sprintf(modew + 2, "%d", clevel);
+		out = hts_open("-", modew, 0);
+		vcf_hdr_write(out, h);
+		b = bcf_init1();
+		str.s = 0, str.l = str.m = 0;
+	} else {
+		puts(str.s);
+	}
+
+	// write records
+	for (k = 0; k < n_site; ++k) {
+		pos += 1 + (int)(drand48() * (2 * dist - 1));
+		sim_site(&s);
+		str.l = 0;
+		kputs(chr, &str); kputc('\t', &str); kputl(pos, &str);
+		kputs("\t.\tA\tT\t.\tPASS\t.\tGT", &str);
+		ks_resize(&str, str.l + s.n_hap * 2 + 2);
+		for (i = 0; i < s.n_hap; i += 2) {
+			if (s.r_mis > 0. && drand48() < s.r_mis) {
+				memcpy(str.s + str.l, "\t./.", 4);
+			} else {
+				str.s[str.l] = '\t', str.s[str.l+1] = '0' + s.a[i];
+				str.s[str.l+2] = '|', str.s[str.l+3] = '0' + s.a[i+1];
+			}
+			str.l += 4;
+		}
+		str.s[str.l] = 0;
+		if (bcf_out) {
+			vcf_parse1(&str, h, b);
+			vcf_write1(out, h, b);
+		} else puts(str.s);
+	}
+
+	if (bcf_out) {
+		bcf_destroy1(b);
+		hts_close(out);
+		bcf_hdr_destroy(h);
+	}
+	free(str.s);
+	sim_destroy(&s);
+	return 0;
+}
@@ -0,0 +1,449 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <ctype.h>
+#include <pthread.h>
+#include "bgt.h"
+
+/* Per-group AC/AN come from bgtm_cal_info() and are accumulated in windows
+ * of -w bp starting at multiples of -w. A region is split into chunks of
+ * whole windows; each thread reads a chunk with its own reader. A site
+ * belongs to the chunk containing its start, so the output does not depend on
+ * the number of threads.
+ *
+ * Per window and group, pi is the sum of 2*AC*(AN-AC)/(AN*(AN-1)) over sites,
+ * theta_W is the number of segregating sites over a_1, Ho is the fraction of
+ * heterozygous genotypes among called genotypes and Tajima's D uses the
+ * number of haplotypes in the group as the sample size. Fst is Hudson's
+ * estimator, the ratio of sums over sites. The SFS counts ALT alleles at sites
+ * without missing genotypes in the group.
+ *
+ * Per-sample counters are kept in a block of ST_N_CNT 64-bit integers per
+ * sample, one cache line, and per site class with -c. Each thread has its
+ * own counters, which are summed at the end. */
+
+enum { ST_HOM_REF, ST_HET, ST_HOM_ALT, ST_MISS, ST_OTHER, ST_SINGLE, ST_TS, ST_TV, ST_N_CNT };
+enum { ST_SNP, ST_INDEL, ST_CLS_OTHER, ST_N_CLS };
+
+typedef struct {
+	int n_site, n_seg;
+	double pi;
+	int64_t n_het, n_gt;
+} st_grp_t;
+
+typedef struct {
+	int n_site;
+	double num, den;
+} st_fst_t;
+
+typedef struct {
+	int rid, beg, end; // [beg,end) on contig rid
+	kstring_t out;
+} st_chunk_t;
+
+typedef struct {
+	int n_files, n_gexpr, win, n_groups;
+	int per_sample, by_class, n_out, n_cnt; // n_cnt: number of counters per thread
+	bgt_file_t **files;
+	char **gexpr;
+	const bcf_hdr_t *h;
+	int n_hap[BGT_MAX_GROUPS], sfs_off[BGT_MAX_GROUPS+1];
+	int n_chunks, next;
+	st_chunk_t *chunks;
+	pthread_mutex_t lock;
+} st_shared_t;
+
+typedef struct {
+	st_shared_t *s;
+	uint64_t *cnt; // SFS, or per-sample counters
+} st_worker_t;
+
+static void st_tajima(int n, int S, double pi, kstring_t *out)
+{
+	double a1 = 0., a2 = 0., b1, b2, c1, c2, e1, e2;
+	int i;
+	if (n < 4 || S == 0) {
+		kputs("\tNA", out);
+		return;
+	}
+	for (i = 1; i < n; ++i) a1 += 1. / i, a2 += 1. / ((double)i * i);
+	b1 = (n + 1.) / (3. * (n - 1.));
+	b2 = 2. * ((double)n * n + n + 3.) / (9. * n * (n - 1.));
+	c1 = b1 - 1. / a1;
+	c2 = b2 - (n + 2.) / (a1 * n) + a2 / (a1 * a1);
+	e1 = c1 / a1, e2 = c2 / (a1 * a1 + a2);
+	ksprintf(out, "\t%.4f", (pi - S / a1) / sqrt(e1 * S + e2 * S * (S - 1.)));
+}
+
+static void st_flush(const st_shared_t *s, st_chunk_t *c, int w, st_grp_t *g, st_fst_t *f)
+{
+	int i, j, k, len = s->h->id[BCF_DT_CTG][c->rid].val->info[0];
+	const char *chr = s->h->id[BCF_DT_CTG][c->rid].key;
+	int64_t beg = (int64_t)w * s->win, end = beg + s->win;
+	if (len > 0 && end > len) end = len;
+	for (i = 0; i < s->n_groups; ++i) {
+		double a1 = 0.;
+		st_grp_t *p = &g[i];
+		if (p->n_site == 0) continue;
+		for (j = 1; j < s->n_hap[i]; ++j) a1 += 1. / j;
+		ksprintf(&c->out, "ST\t%s\t%lld\t%lld\t%d\t%d\t%d\t%.4f\t%.4f", chr, (long long)beg + 1, (long long)end, i + 1, p->n_site, p->n_seg, p->pi, a1 > 0.? p->n_seg / a1 : 0.);
+		if (p->n_gt > 0) ksprintf(&c->out, "\t%.4f", (double)p->n_het / p->n_gt);
+		else kputs("\tNA", &c->out);
+		st_tajima(s->n_hap[i], p->n_seg, p->pi, &c->out);
+		kputc('\n', &c->out);
+	}
+	for (i = k = 0; i < s->n_groups; ++i) {
+		for (j = i + 1; j < s->n_groups; ++j, ++k) {
+			if (f[k].n_site == 0) continue;
+			ksprintf(&c->out, "FS\t%s\t%lld\t%lld\t%d\t%d\t%d\t", chr, (long long)beg + 1, (long long)end, i + 1, j + 1, f[k].n_site);
+			if (f[k].den > 0.) ksprintf(&c->out, "%.4f\n", f[k].num / f[k].den);
+			else kputs("NA\n", &c->out);
+		}
+	}
+	memset(g, 0, s->n_groups * sizeof(st_grp_t));
+	memset(f, 0, s->n_groups * (s->n_groups - 1) / 2 * sizeof(st_fst_t));
+}
+
+static bgtm_t *st_reader_init(const st_shared_t *s)
+{
+	int i;
+	bgtm_t *bm;
+	bm = bgtm_reader_init(s->n_files, s->files);
+	bgtm_set_flag(bm, BGT_F_NO_GT);
+	for (i = 0; i < s->n_gexpr; ++i)
+		if (bgtm_add_group(bm, s->gexpr[i]) < 0) {
+			bgtm_reader_destroy(bm);
+			return 0;
+		}
+	return bm;
+}
+
+static bgtm_t *st_chunk_reader(const st_shared_t *s, const st_chunk_t *c)
+{
+	bgtm_t *bm;
+	char *reg;
+	bm = st_reader_init(s);
+	reg = (char*)malloc(strlen(s->h->id[BCF_DT_CTG][c->rid].key) + 32);
+	sprintf(reg, "%s:%d-%d", s->h->id[BCF_DT_CTG][c->rid].key, c->beg + 1, c->end);
+	bgtm_set_region(bm, reg);
+	bgtm_prepare(bm);
+	free(reg);
+	return bm;
+}
+
+static void st_chunk(st_shared_t *s, st_chunk_t *c, uint64_t *sfs)
+{
+	bgtm_t *bm;
+	bcf1_t *b;
+	bgt_info_t ss;
+	st_grp_t g[BGT_MAX_GROUPS];
+	st_fst_t *f;
+	int i, j, k, w = -1;
+
+	bm = st_chunk_reader(s, c);
+	memset(g, 0, sizeof(g));
+	f = (st_fst_t*)calloc(s->n_groups * s->n_groups, sizeof(st_fst_t));
+	b = bcf_init1();
+	while (bgtm_read(bm, b) >= 0) {
+		if (b->pos < c->beg) continue; // belonging to the previous chunk
+		if (b->pos >= c->end) break;
+		if (b->pos / s->win != w) {
+			if (w >= 0) st_flush(s, c, w, g, f);
+			w = b->pos / s->win;
+		}
+		bgtm_cal_info(bm, &ss);
+		if (ss.n_groups == 1) ss.gan[0] = ss.an, ss.gac[0][0] = ss.ac[0];
+		for (i = 0; i < bm->n_out; ++i) { // observed heterozygosity
+			int c1 = bm->a[1][i<<1] << 1 | bm->a[0][i<<1], c2 = bm->a[1][i<<1|1] << 1 | bm->a[0][i<<1|1];
+			if (c1 == 2 || c2 == 2) continue;
+			++g[bm->group[i] - 1].n_gt;
+			if (c1 != c2) ++g[bm->group[i] - 1].n_het;
+		}
+		for (i = 0; i < s->n_groups; ++i) {
+			int an = ss.gan[i], ac = ss.gac[i][0];
+			if (an == 0) continue;
+			++g[i].n_site;
+			if (ac > 0 && ac < an) ++g[i].n_seg;
+			if (an > 1) g[i].pi += 2. * ac * (an - ac) / ((double)an * (an - 1));
+			if (an == s->n_hap[i]) ++sfs[s->sfs_off[i] + ac];
+		}
+		for (i = k = 0; i < s->n_groups; ++i) {
+			for (j = i + 1; j < s->n_groups; ++j, ++k) {
+				int n1 = ss.gan[i], n2 = ss.gan[j];
+				double p1, p2;
+				if (n1 < 2 || n2 < 2) continue;
+				p1 = (double)ss.gac[i][0] / n1, p2 = (double)ss.gac[j][0] / n2;
+				++f[k].n_site;
+				f[k].num += (p1 - p2) * (p1 - p2) - p1 * (1. - p1) / (n1 - 1) - p2 * (1. - p2) / (n2 - 1);
+				f[k].den += p1 * (1. - p2) + p2 * (1. - p1);
+			}
+		}
+	}
+	if (w >= 0) st_flush(s, c, w, g, f);
+	bcf_destroy1(b);
+	free(f);
+	bgtm_reader_destroy(bm);
+}
+
+static int st_class(const bcf1_t *b, int *is_ts)
+{
+	int l_ref, l_alt, x, y;
+	char *ref, *alt;
+	bcf_get_ref_alt1(b, &l_ref, &ref, &l_alt, &alt);
+	*is_ts = 0;
+	if (l_alt == 0 || *alt == '<') return ST_CLS_OTHER;
+	if (l_ref != l_alt) return ST_INDEL;
+	if (l_ref != 1) return ST_CLS_OTHER;
+	x = toupper(*ref), y = toupper(*alt);
+	*is_ts = ((x == 'A' || x == 'G') && (y == 'A' || y == 'G')) || ((x == 'C' || x == 'T') && (y == 'C' || y == 'T'));
+	return ST_SNP;
+}
+
+static void st_sample_chunk(st_shared_t *s, st_chunk_t *c, uint64_t *cnt)
+{
+	bgtm_t *bm;
+	bcf1_t *b;
+	bgt_info_t ss;
+
+	bm = st_chunk_reader(s, c);
+	b = bcf_init1();
+	while (bgtm_read(bm, b) >= 0) {
+		int i, cls, is_ts;
+		uint64_t *x;
+		if (b->pos < c->beg) continue;
+		if (b->pos >= c->end) break;
+		bgtm_cal_info(bm, &ss);
+		cls = st_class(b, &is_ts);
+		x = s->by_class? cnt + (size_t)cls * bm->n_out * ST_N_CNT : cnt;
+		for (i = 0; i < bm->n_out; ++i, x += ST_N_CNT) {
+			int c1 = bm->a[1][i<<1] << 1 | bm->a[0][i<<1], c2 = bm->a[1][i<<1|1] << 1 | bm->a[0][i<<1|1];
+			if (c1 == 2 || c2 == 2) ++x[ST_MISS];
+			else if (c1 == 3 || c2 == 3) ++x[ST_OTHER];
+			else ++x[ST_HOM_REF + c1 + c2];
+			if (c1 == 1 || c2 == 1) {
+				if (ss.ac[0] == 1) ++x[ST_SINGLE];
+				if (cls == ST_SNP) ++x[is_ts? ST_TS : ST_TV];
+			}
+		}
+	}
+	bcf_destroy1(b);
+	bgtm_reader_destroy(bm);
+}
+
+static void *st_worker(void *data)
+{
+	st_worker_t *w = (st_worker_t*)data;
+	st_shared_t *s = w->s;
+	for (;;) {
+		int i;
+		pthread_mutex_lock(&s->lock);
+		i = s->next++;
+		pthread_mutex_unlock(&s->lock);
+		if (i >= s->n_chunks) break;
+		if (s->per_sample) st_sample_chunk(s, &s->chunks[i], w->cnt);
+		else st_chunk(s, &s->chunks[i], w->cnt);
+	}
+	return 0;
+}
+
+static void st_add_chunks(st_shared_t *s, int rid, int beg, int end, int n_win) // split [beg,end) into chunks of n_win windows
+{
+	int64_t x;
+	for (x = beg; x < end;) {
+		int64_t y = (x / s->win + n_win) * s->win;
+		st_chunk_t *c;
+		s->chunks = (st_chunk_t*)realloc(s->chunks, (s->n_chunks + 1) * sizeof(st_chunk_t));
+		c = &s->chunks[s->n_chunks++];
+		memset(c, 0, sizeof(st_chunk_t));
+		c->rid = rid, c->beg = x, c->end = y < end? y : end;
+		x = c->end;
+	}
+}
+
+// open BGTs and split the region into chunks; return a prepared reader for the sample list
+static bgtm_t *st_init(st_shared_t *s, int n_files, char *const* fn, const char *reg, int n_threads)
+{
+	int i, rid = -1, beg = 0, end = 0, n_win;
+	int64_t tot_win = 0;
+	bgtm_t *bm;
+
+	s->n_files = n_files;
+	s->files = (bgt_file_t**)calloc(n_files, sizeof(bgt_file_t*));
+	for (i = 0; i < n_files; ++i) {
+		if ((s->files[i] = bgt_open(fn[i])) == 0) {
+			fprintf(stderr, "[E::%s] failed to open BGT with prefix '%s'\n", __func__, fn[i]);
+			return 0;
+		}
+	}
+	s->h = s->files[0]->h0;
+	if ((bm = st_reader_init(s)) == 0) {
+		fprintf(stderr, "[E::%s] failed to add sample groups.\n", __func__);
+		return 0;
+	}
+	bgtm_prepare(bm);
+	s->n_groups = bm->n_groups, s->n_out = bm->n_out;
+	for (i = 0; i < bm->n_out; ++i) s->n_hap[bm->group[i] - 1] += 2;
+
+	if (reg) { // a single region
+		const char *q = hts_parse_reg(reg, &beg, &end);
+		char *name = (char*)calloc(q - reg + 1, 1);
+		strncpy(name, reg, q - reg);
+		if ((rid = bcf_name2id(s->h, name)) < 0) rid = bcf_name2id(s->h, reg), beg = 0, end = 1<<29;
+		free(name);
+		if (rid < 0) {
+			fprintf(stderr, "[E::%s] failed to set region. Region format error?\n", __func__);
+			bgtm_reader_destroy(bm);
+			return 0;
+		}
+	}
+	for (i = 0; i < s->h->n[BCF_DT_CTG]; ++i) { // count windows
+		int len = s->h->id[BCF_DT_CTG][i].val->info[0];
+		if (rid >= 0 && i != rid) continue;
+		if (len <= 0) len = 1<<29;
+		if (rid >= 0) tot_win += ((end < len? end : len) - 1) / s->win - beg / s->win + 1;
+		else tot_win += (len - 1) / s->win + 1;
+	}
+	n_win = n_threads == 1? 1<<30 : tot_win / (n_threads * 4) > 1? tot_win / (n_threads * 4) : 1;
+	for (i = 0; i < s->h->n[BCF_DT_CTG]; ++i) {
+		int len = s->h->id[BCF_DT_CTG][i].val->info[0];
+		if (rid >= 0 && i != rid) continue;
+		if (len <= 0) len = 1<<29;
+		if (rid >= 0) st_add_chunks(s, i, beg, end < len? end : len, n_win);
+		else st_add_chunks(s, i, 0, len, n_win);
+	}
+	return bm;
+}
+
+// process chunks with n_threads threads and print the output in order; return counters summed over threads
+static uint64_t *st_run(st_shared_t *s, int n_threads)
+{
+	int i, j;
+	uint64_t *cnt;
+	st_worker_t *w;
+	pthread_t *tid;
+	pthread_mutex_init(&s->lock, 0);
+	tid = (pthread_t*)calloc(n_threads, sizeof(pthread_t));
+	w = (st_worker_t*)calloc(n_threads, sizeof(st_worker_t));
+	for (i = 0; i < n_threads; ++i) {
+		w[i].s = s;
+		w[i].cnt = (uint64_t*)calloc(s->n_cnt, 8);
+		pthread_create(&tid[i], 0, st_worker, &w[i]);
+	}
+	for (i = 0; i < n_threads; ++i) pthread_join(tid[i], 0);
+	for (i = 0; i < s->n_chunks; ++i) {
+		if (s->chunks[i].out.l) fwrite(s->chunks[i].out.s, 1, s->chunks[i].out.l, stdout);
+		free(s->chunks[i].out.s);
+	}
+	for (i = 1; i < n_threads; ++i) {
+		for (j = 0; j < s->n_cnt; ++j)
+			w[0].cnt[j] += w[i].cnt[j];
+		free(w[i].cnt);
+	}
+	cnt = w[0].cnt;
+	pthread_mutex_destroy(&s->lock);
+	free(w); free(tid);
+	return cnt;
+}
+
+static void st_destroy(st_shared_t *s)
+{
+	int i;
+	for (i = 0; i < s->n_files; ++i)
+		if (s->files[i]) bgt_close(s->files[i]);
+	free(s->files); free(s->chunks);
+}
+
+int main_stats(int argc, char *argv[])
+{
+	int i, j, c, n_threads = 1;
+	char *reg = 0, *gexpr[BGT_MAX_GROUPS];
+	st_shared_t s;
+	uint64_t *sfs;
+	bgtm_t *bm;
+
+	memset(&s, 0, sizeof(st_shared_t));
+	s.win = 100000, s.gexpr = gexpr;
+	while ((c = getopt(argc, argv, "s:r:w:t:")) >= 0) {
+		if (c == 's' && s.n_gexpr < BGT_MAX_GROUPS) gexpr[s.n_gexpr++] = optarg;
+		else if (c == 'r') reg = optarg;
+		else if (c == 'w') s.win = atoi(optarg);
+		else if (c == 't') n_threads = atoi(optarg);
+	}
+	if (optind == argc) {
+		fprintf(stderr, "Usage: bgt stats [options] <bgt-prefix> [...]\n");
+		fprintf(stderr, "Options:\n");
+		fprintf(stderr, "  -s EXPR    samples list (,sample1,sample2 or a file or expression); one group per -s [all]\n");
+		fprintf(stderr, "  -r STR     region [all]\n");
+		fprintf(stderr, "  -w INT     window size in bp [%d]\n", s.win);
+		fprintf(stderr, "  -t INT     number of threads [%d]\n", n_threads);
+		fprintf(stderr, "Output:\n");
+		fprintf(stderr, "  ST chr beg end group #sites #segregating pi theta_W Ho Tajima's_D\n");
+		fprintf(stderr, "  FS chr beg end group1 group2 #sites Fst\n");
+		fprintf(stderr, "  SF group #ALT #sites\n");
+		return 1;
+	}
+	if (n_threads < 1) n_threads = 1;
+	if (s.win < 1) s.win = 1;
+
+	if ((bm = st_init(&s, argc - optind, argv + optind, reg, n_threads)) == 0) return 1;
+	bgtm_reader_destroy(bm);
+	for (i = 0; i < s.n_groups; ++i) s.sfs_off[i+1] = s.sfs_off[i] + s.n_hap[i] + 1;
+	s.n_cnt = s.sfs_off[s.n_groups];
+	sfs = st_run(&s, n_threads);
+	for (i = 0; i < s.n_groups; ++i)
+		for (j = 0; j <= s.n_hap[i]; ++j)
+			printf("SF\t%d\t%d\t%lld\n", i + 1, j, (long long)sfs[s.sfs_off[i] + j]);
+	free(sfs);
+	st_destroy(&s);
+	return 0;
+}
+
+int main_sample_stats(int argc, char *argv[])
+{
+	int i, j, k, c, n_threads = 1;
+	char *reg = 0, *gexpr[BGT_MAX_GROUPS];
+	static const char *cls_name[ST_N_CLS] = { "SNP", "INDEL", "OTHER" };
+	st_shared_t s;
+	uint64_t *cnt;
+	bgtm_t *bm;
+
+	memset(&s, 0, sizeof(st_shared_t));
+	s.win = 1000000, s.gexpr = gexpr, s.per_sample = 1;
+	while ((c = getopt(argc, argv, "s:r:ct:")) >= 0) {
+		if (c == 's' && s.n_gexpr < BGT_MAX_GROUPS) gexpr[s.n_gexpr++] = optarg;
+		else if (c == 'r') reg = optarg;
+		else if (c == 'c') s.by_class = 1;
+		else if (c == 't') n_threads = atoi(optarg);
+	}
+	if (optind == argc) {
+		fprintf(stderr, "Usage: bgt sample-stats [options] <bgt-prefix> [...]\n");
+		fprintf(stderr, "Options:\n");
+		fprintf(stderr, "  -s EXPR    samples list (,sample1,sample2 or a file or expression) [all]\n");
+		fprintf(stderr, "  -r STR     region [all]\n");
+		fprintf(stderr, "  -c         count SNPs, INDELs and other sites separately\n");
+		fprintf(stderr, "  -t INT     number of threads [%d]\n", n_threads);
+		fprintf(stderr, "Output: SS sample class #homRef #het #homAlt #missing #otherAlt #singletons #Ts #Tv Ts/Tv\n");
+		return 1;
+	}
+	if (n_threads < 1) n_threads = 1;
+
+	if ((bm = st_init(&s, argc - optind, argv + optind, reg, n_threads)) == 0) return 1;
+	s.n_cnt = (s.by_class? ST_N_CLS : 1) * s.n_out * ST_N_CNT;
+	cnt = st_run(&s, n_threads);
+	for (i = 0; i < bm->n_out; ++i) {
+		const char *name = bm->bgt[bm->sample_idx[i]>>32]->f->f->rows[(uint32_t)bm->sample_idx[i]].name;
+		for (k = 0; k < (s.by_class? ST_N_CLS : 1); ++k) {
+			const uint64_t *x = &cnt[((size_t)k * s.n_out + i) * ST_N_CNT];
+			printf("SS\t%s\t%s", name, s.by_class? cls_name[k] : "ALL");
+			for (j = 0; j < ST_N_CNT; ++j) printf("\t%lld", (long long)x[j]);
+			if (x[ST_TV] > 0) printf("\t%.4f\n", (double)x[ST_TS] / x[ST_TV]);
+			else printf("\tNA\n");
+		}
+	}
+	free(cnt);
+	bgtm_reader_destroy(bm);
+	st_destroy(&s);
+	return 0;
+}
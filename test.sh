@@ -33,3 +33,46 @@ echo 17a6a271f0057b6dbfe9b44c6317c5c7
 echo 76633b2f9efe8d5b8b39868bb24a51f4
 echo 722ae5f5671c4e024842c59f80a11d16
 echo 7709cceaec9a1f084e3f509a72a7a615
+
+echo -e "\nMESSAGE: checking that import options and 'view --bgt' round-trip on ex2.vcf and ex3.vcf..."
+for ex in ex2 ex3; do
+	$EXE import -S $ex.bgt $ex.vcf
+	$EXE view $ex.bgt > $ex.all.vcf
+	$EXE view -s,S1 $ex.bgt > $ex.S1.vcf
+	for opt in "-k 0" "-D" "-c 8" "-I" "--bgt"; do
+		if [ "$opt" = "--bgt" ]; then
+			$EXE view -o $ex.tmp.bgt --bgt $ex.bgt
+		else
+			$EXE import -S $opt $ex.tmp.bgt $ex.vcf
+		fi
+		$EXE view $ex.tmp.bgt | cmp -s - $ex.all.vcf && $EXE view -s,S1 $ex.tmp.bgt | cmp -s - $ex.S1.vcf \
+			&& echo "OK   $ex $opt" || echo "FAIL $ex $opt"
+	done
+done
+
+echo -e "\nMESSAGE: checking analyses on ex4.vcf against answers derived by hand..."
+$EXE import -S ex4.bgt ex4.vcf
+# S1:1/S2:1 and S2:2/S3:2 are the only pairs of haplotypes identical at 4 or more adjacent sites
+[ "`$EXE ibd -L 4 ex4.bgt | sort`" = "`printf 'S1:1\tS2:1\t11\t101\t105\t5\nS2:2\tS3:2\t11\t101\t105\t5'`" ] \
+	&& echo "OK   ibd" || echo "FAIL ibd"
+# KING-robust: S1-S2 (3-2*0)/(4+5), S1-S3 (3-2*2)/(4+3), S2-S3 (3-2*1)/(5+3), and 1/2 on the diagonal
+$EXE grm -o ex4.grm ex4.bgt 2> /dev/null
+[ "`od -An -tf4 -v ex4.grm.bin | xargs`" = "0.5 0.33333334 -0.14285715 0.33333334 0.5 0.125 -0.14285715 0.125 0.5" ] \
+	&& echo "OK   grm" || echo "FAIL grm"
+
+echo -e "\nMESSAGE: computing checksum of analyses on ex2.vcf..."
+$EXE import -S -D ex2.D.bgt ex2.vcf
+$EXE match -s S1 ex2.D.bgt | $MD5 | awk '{print $1}'
+$EXE ibd -L 1 ex2.bgt | $MD5 | awk '{print $1}'
+$EXE ld -m 0 ex2.bgt | $MD5 | awk '{print $1}'
+$EXE stats ex2.bgt | $MD5 | awk '{print $1}'
+$EXE grm -o ex2.grm ex2.bgt 2> /dev/null && $MD5 ex2.grm.bin | awk '{print $1}'
+$EXE view -o ex2.plink --plink ex2.bgt && cat ex2.plink.bed ex2.plink.bim ex2.plink.fam | $MD5 | awk '{print $1}'
+
+echo -e "\nCorrect checksum should be:"
+echo 2f14a09d153f4bf2f36935ea1b21546b
+echo 381fd9183676922bf9ed59d1846795c4
+echo 3ec27765a0fa06b0487d2ae9a4a59e15
+echo c37736713f484c02ab584240d4c0e934
+echo 6a3981e92a9b5e90a8de591d0ff0dcba
+echo 4766e9121a5ac8ac3af38b47b0f98cdd
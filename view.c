@@ -3,6 +3,7 @@
 #include <string.h>
 #include <limits.h>
 #include <stdio.h>
+#include <getopt.h>
 #include "bgt.h"
 #include "kexpr.h"
 #include "fmf.h"
@@ -11,22 +12,232 @@ void *bed_read(const char *fn);
 void bed_destroy(void *_h);
 char **hts_readlines(const char *fn, int *_n);
 
+static void bgt_stats_print(FILE *fp, const bgt_stats_t *st)
+{
+	static const char *name[BGT_N_ST] = { "BCF", "PBF seek", "PBF decode", "AC/AN", "filter", "genotypes", "format" };
+	uint64_t tot = 0;
+	int i;
+	for (i = 0; i < BGT_N_ST; ++i) tot += st->t[i];
+	fprintf(fp, "[M::%s] stage       ticks        %%  events\n", __func__);
+	for (i = 0; i < BGT_N_ST; ++i)
+		fprintf(fp, "[M::%s] %-10s %12lld %5.1f %7lld\n", __func__, name[i], (long long)st->t[i], tot? 100. * st->t[i] / tot : 0., (long long)st->n[i]);
+	fprintf(fp, "[M::%s] %lld sites read; %lld sites output; %lld genotypes read\n", __func__, (long long)st->n_site_read, (long long)st->n_site_out, (long long)st->n_gt_read);
+	fprintf(fp, "[M::%s] %lld PBF rows decoded, of which %lld were replayed; %lld checkpoints loaded\n", __func__,
+			(long long)st->n_row_dec, (long long)st->n_row_replay, (long long)st->n_ckpt);
+}
+
+/****************
+ * PLINK output *
+ ****************/
+
+/* Genotypes are written to .bed in the SNP-major mode with A1=ALT and A2=REF.
+ * The two haplotypes of a sample, each coded as a[1]<<1|a[0], are mapped to a
+ * 2-bit PLINK genotype with a 16-entry table: 00 for ALT/ALT, 10 for REF/ALT,
+ * 11 for REF/REF and 01 (missing) if either haplotype is missing or carries
+ * another ALT allele. As with VCF output, samples hidden by _mgs are dropped.
+ * When no samples are dropped, 64 haplotypes are packed into a word with a
+ * multiplication per 8 bytes and 32 genotypes are computed with bit operations. */
+
+typedef struct {
+	FILE *bed, *bim;
+	int n, *idx; // idx[j]: the j-th written sample in bgtm_t::a
+	uint8_t *buf;
+} plink_t;
+
+static int plink_sex(const fmf_t *f, int r) // 1 for male, 2 for female and 0 for unknown
+{
+	int i, j;
+	const fmf1_t *p = &f->rows[r];
+	for (i = 0; i < p->n_meta; ++i) {
+		const char *key = f->keys[p->meta[i].key];
+		if (strcmp(key, "gender") && strcmp(key, "sex")) continue;
+		if (p->meta[i].type == FMF_INT) j = p->meta[i].v.i;
+		else if (p->meta[i].type == FMF_STR) {
+			const char *v = f->vals[p->meta[i].v.s];
+			j = *v == 'M' || *v == 'm' || *v == '1'? 1 : *v == 'F' || *v == 'f' || *v == '2'? 2 : 0;
+		} else continue;
+		return j == 1 || j == 2? j : 0;
+	}
+	return 0;
+}
+
+static plink_t *plink_open(const bgtm_t *bm, const char *prefix)
+{
+	static const uint8_t magic[3] = { 0x6c, 0x1b, 0x01 };
+	plink_t *p;
+	FILE *fam;
+	char *fn;
+	int i;
+
+	fn = (char*)malloc(strlen(prefix) + 5);
+	p = (plink_t*)calloc(1, sizeof(plink_t));
+	sprintf(fn, "%s.fam", prefix);
+	if ((fam = fopen(fn, "w")) == 0) goto plink_err;
+	sprintf(fn, "%s.bim", prefix);
+	if ((p->bim = fopen(fn, "w")) == 0) goto plink_err;
+	sprintf(fn, "%s.bed", prefix);
+	if ((p->bed = fopen(fn, "wb")) == 0) goto plink_err;
+	free(fn);
+	p->idx = (int*)malloc((bm->n_out + 1) * sizeof(int));
+	for (i = 0; i < bm->n_out; ++i) {
+		const fmf_t *f = bm->bgt[bm->sample_idx[i]>>32]->f->f;
+		int r = (uint32_t)bm->sample_idx[i];
+		if (bm->mgs[i] > 1) continue;
+		fprintf(fam, "%s\t%s\t0\t0\t%d\t-9\n", f->rows[r].name, f->rows[r].name, plink_sex(f, r));
+		p->idx[p->n++] = i;
+	}
+	fclose(fam);
+	p->buf = (uint8_t*)malloc((p->n + 3) >> 2);
+	fwrite(magic, 1, 3, p->bed);
+	return p;
+
+plink_err:
+	fprintf(stderr, "[E::%s] failed to write to file '%s'\n", __func__, fn);
+	if (fam) fclose(fam);
+	if (p->bim) fclose(p->bim);
+	free(p); free(fn);
+	return 0;
+}
+
+static inline uint64_t plink_pack8(const uint8_t *a) // 8 bytes of 0/1 to 8 bits
+{
+	uint64_t x;
+	memcpy(&x, a, 8);
+	return (x * 0x0102040810204080ULL) >> 56;
+}
+
+static void plink_write(plink_t *p, const bgtm_t *bm, bcf1_t *b)
+{
+	static const uint8_t code[16] = { 3, 2, 2, 0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1 };
+	const uint8_t *a0 = bm->a[0], *a1 = bm->a[1];
+	int j = 0, k;
+	bcf_unpack(b, BCF_UN_STR);
+	fprintf(p->bim, "%s\t%s\t0\t%d\t%s\t%s\n", bm->h_out->id[BCF_DT_CTG][b->rid].key, b->d.id, b->pos + 1,
+			b->n_allele > 1? b->d.allele[1] : ".", b->d.allele[0]);
+	memset(p->buf, 0, (p->n + 3) >> 2);
+	if (p->n == bm->n_out) { // no samples dropped: 32 samples per 64-bit word
+		const uint64_t m1 = 0x5555555555555555ULL;
+		for (; j + 32 <= p->n; j += 32) {
+			uint64_t x = 0, y = 0, a, o, c;
+			for (k = 0; k < 8; ++k) {
+				x |= plink_pack8(&a0[(j<<1) + (k<<3)]) << (k<<3);
+				y |= plink_pack8(&a1[(j<<1) + (k<<3)]) << (k<<3);
+			}
+			a = x & x>>1 & m1, o = (x | x>>1) & m1; // both or either haplotype having ALT
+			c = (~o & m1) | (~a & m1) << 1;
+			y = (y | y>>1) & m1; // missing or another ALT on either haplotype
+			c = (c & ~(y | y<<1)) | y;
+			for (k = 0; k < 8; ++k) p->buf[(j>>2) + k] = c >> (k<<3);
+		}
+	}
+	for (; j < p->n; ++j) {
+		int k = p->idx[j] << 1;
+		p->buf[j>>2] |= code[a0[k] | a0[k|1]<<1 | a1[k]<<2 | a1[k|1]<<3] << ((j&3)<<1);
+	}
+	fwrite(p->buf, 1, (p->n + 3) >> 2, p->bed);
+}
+
+static void plink_close(plink_t *p)
+{
+	fclose(p->bed); fclose(p->bim);
+	free(p->idx); free(p->buf); free(p);
+}
+
+/**************
+ * BGT output *
+ **************/
+
+/* The subset is written as a new BGT without atomization: selected .spl rows
+ * are copied with their metadata, bgtm_t::a is passed to pbf_write() as is and
+ * site records are rebuilt with the allele part of the output record and a new
+ * _row, under the site-only header of the first input. */
+
+typedef struct {
+	char *fn; // the BCF file name, kept for indexing at the end
+	htsFile *bcf;
+	const bcf_hdr_t *h0;
+	bcf1_t *b;
+	pbf_t *pb;
+	int32_t n;
+} bgtw_t;
+
+static bgtw_t *bgtw_open(const bgtm_t *bm, const char *prefix)
+{
+	const bgt_file_t *f0 = bm->bgt[0]->f;
+	bgtw_t *w;
+	FILE *fp;
+	int i;
+
+	w = (bgtw_t*)calloc(1, sizeof(bgtw_t));
+	w->fn = (char*)malloc(strlen(prefix) + 5);
+	sprintf(w->fn, "%s.spl", prefix);
+	if ((fp = fopen(w->fn, "w")) == 0) goto bgtw_err;
+	for (i = 0; i < bm->n_out; ++i) {
+		char *s;
+		s = fmf_write(bm->bgt[bm->sample_idx[i]>>32]->f->f, (uint32_t)bm->sample_idx[i]);
+		fputs(s, fp); fputc('\n', fp);
+		free(s);
+	}
+	fclose(fp);
+	sprintf(w->fn, "%s.pbf", prefix);
+	if ((w->pb = pbf_open_w(w->fn, bm->n_out<<1, 2, pbf_get_shift(f0->pb))) == 0) goto bgtw_err;
+	sprintf(w->fn, "%s.bcf", prefix);
+	if ((w->bcf = hts_open(w->fn, "wb", 0)) == 0) goto bgtw_err;
+	w->h0 = f0->h0;
+	vcf_hdr_write(w->bcf, w->h0);
+	w->b = bcf_init1();
+	return w;
+
+bgtw_err:
+	fprintf(stderr, "[E::%s] failed to write to file '%s'\n", __func__, w->fn);
+	if (w->pb) pbf_close(w->pb);
+	free(w->fn); free(w);
+	return 0;
+}
+
+static void bgtw_write(bgtw_t *w, const bgtm_t *bm, const bcf1_t *b)
+{
+	bcfcpy_min(w->b, b, b->n_allele > 2? "<M>" : 0);
+	bcf_append_info_ints(w->h0, w->b, "_row", 1, &w->n);
+	vcf_write1(w->bcf, w->h0, w->b);
+	pbf_write(w->pb, bm->a);
+	++w->n;
+}
+
+static void bgtw_close(bgtw_t *w)
+{
+	hts_close(w->bcf);
+	pbf_close(w->pb);
+	bcf_index_build(w->fn, 14);
+	bcf_destroy1(w->b);
+	free(w->fn); free(w);
+}
+
 int main_view(int argc, char *argv[])
 {
-	int i, c, n_files = 0, out_bcf = 0, clevel = -1, multi_flag = 0, excl = 0, not_vcf = 0, in_mem = 0, u_set = 0;
+	int i, c, n_files = 0, out_bcf = 0, clevel = -1, multi_flag = 0, excl = 0, not_vcf = 0, in_mem = 0, u_set = 0, out_plink = 0, out_bgt = 0, n_threads = 0;
 	long seekn = -1, n_rec = LONG_MAX, n_read = 0;
 	bgtm_t *bm = 0;
 	bcf1_t *b;
 	htsFile *out = 0;
-	char modew[8], *reg = 0, *site_flt = 0;
+	char modew[8], *reg = 0, *site_flt = 0, *prefix = 0;
 	void *bed = 0;
+	plink_t *plink = 0;
+	bgtw_t *bgtw = 0;
 	int n_groups = 0;
 	char *gexpr[BGT_MAX_GROUPS], *aexpr = 0, *dbfn = 0, *fmt = 0;
 	bgt_file_t **files = 0;
 	fmf_t *vardb = 0;
 
-	while ((c = getopt(argc, argv, "ubs:r:l:CMGB:ef:g:a:i:n:SHt:d:")) >= 0) {
+	static struct option lopts[] = { { "stats", no_argument, 0, 300 }, { "plink", no_argument, 0, 301 }, { "bgt", no_argument, 0, 302 }, { 0, 0, 0, 0 } };
+
+	while ((c = getopt_long(argc, argv, "ubs:r:l:CMGB:ef:g:a:i:n:SHt:d:o:@:", lopts, 0)) >= 0) {
 		if (c == 'b') out_bcf = 1;
+		else if (c == 300) multi_flag |= BGT_F_STATS;
+		else if (c == 301) out_plink = 1;
+		else if (c == 302) out_bgt = 1;
+		else if (c == 'o') prefix = optarg;
+		else if (c == '@') n_threads = atoi(optarg);
 		else if (c == 'r') reg = optarg;
 		else if (c == 'l') clevel = atoi(optarg);
 		else if (c == 'e') excl = 1;
@@ -52,6 +263,7 @@ int main_view(int argc, char *argv[])
 	if (clevel > 9) clevel = 9;
 	if (u_set) clevel = 0, out_bcf = 1;
 	if (n_groups > 1) multi_flag |= BGT_F_SET_AC;
+	if (out_plink || out_bgt) multi_flag |= BGT_F_NO_GT, not_vcf = 1; // genotypes are taken from bgtm_t::a
 	if (argc - optind < 1) {
 		fprintf(stderr, "Usage: bgt %s [options] <bgt-prefix> [...]", argv[0]);
 		fputc('\n', stderr);
@@ -79,6 +291,12 @@ int main_view(int argc, char *argv[])
 		fprintf(stderr, "    -H           count of haplotypes with a set of alleles (with -a)\n");
 		fprintf(stderr, "    -t STR       comma-delimited list of fields to output. Accepted variables:\n");
 		fprintf(stderr, "                 AC, AN, AC#, AN#, CHROM, POS, END, REF, ALT (# for a group number)\n");
+		fprintf(stderr, "    --plink      write PLINK binary to STR.bed, STR.bim and STR.fam (with -o)\n");
+		fprintf(stderr, "    --bgt        write the subset as a new BGT with prefix STR (with -o)\n");
+		fprintf(stderr, "    -o STR       output prefix []\n");
+		fprintf(stderr, "  Miscellaneous:\n");
+		fprintf(stderr, "    -@ INT       number of threads for reading ahead and decompressing the BCF [0]\n");
+		fprintf(stderr, "    --stats      print time spent in each stage and other counters to stderr\n");
 		fprintf(stderr, "Notes:\n");
 		fprintf(stderr, "  For option -s/-a, EXPR can be one of:\n");
 		fprintf(stderr, "    1) comma-delimited list following a colon/comma. e.g. -s,NA12878,NA12044\n");
@@ -89,6 +307,16 @@ int main_view(int argc, char *argv[])
 		return 1;
 	}
 
+	if ((out_plink || out_bgt) && prefix == 0) {
+		fprintf(stderr, "[E::%s] -o must be specified when --plink or --bgt is in use.\n", __func__);
+		return 1;
+	}
+	for (i = optind; out_bgt && i < argc; ++i) {
+		if (strcmp(prefix, argv[i]) == 0) {
+			fprintf(stderr, "[E::%s] the output prefix of --bgt must differ from the input.\n", __func__);
+			return 1;
+		}
+	}
 	if (dbfn && in_mem) vardb = fmf_read(dbfn), dbfn = 0;
 
 	if ((multi_flag&(BGT_F_CNT_AL|BGT_F_CNT_HAP)) && aexpr == 0) {
@@ -106,8 +334,14 @@ int main_view(int argc, char *argv[])
 		}
 	}
 
+	if (aexpr && (dbfn || vardb)) // use the annotation join index if available
+		for (i = 0; i < n_files; ++i) bgt_jdx_load(files[i]);
+	if (site_flt) // use the sample index if available
+		for (i = 0; i < n_files; ++i) bgt_sdx_load(files[i]);
+
 	bm = bgtm_reader_init(n_files, files);
 	bgtm_set_flag(bm, multi_flag);
+	if (n_threads > 0) bgtm_set_threads(bm, n_threads);
 	if (site_flt && bgtm_set_flt_site(bm, site_flt) != 0) {
 		fprintf(stderr, "[E::%s] failed to set frequency filters. Syntax error?\n", __func__);
 		return 1;
@@ -146,14 +380,25 @@ int main_view(int argc, char *argv[])
 		out = hts_open("-", modew, 0);
 		vcf_hdr_write(out, bm->h_out);
 	}
+	if (out_plink && (plink = plink_open(bm, prefix)) == 0) return 1;
+	if (out_bgt && (bgtw = bgtw_open(bm, prefix)) == 0) return 1;
 
 	b = bcf_init1();
 	while (bgtm_read(bm, b) >= 0 && n_read < n_rec) {
+		uint64_t t0 = bm->flag & BGT_F_STATS? bgt_tick() : 0;
 		if (out) vcf_write1(out, bm->h_out, b);
 		if (fmt && bm->n_fields > 0) puts(bm->tbl_line.s);
+		if (plink) plink_write(plink, bm, b);
+		if (bgtw) bgtw_write(bgtw, bm, b);
+		if (bm->flag & BGT_F_STATS) bm->st.t[BGT_ST_FMT] += bgt_tick() - t0, ++bm->st.n[BGT_ST_FMT];
 		++n_read;
 	}
 	bcf_destroy1(b);
+	if (bm->flag & BGT_F_STATS) {
+		bgt_stats_t st;
+		bgtm_get_stats(bm, &st);
+		bgt_stats_print(stderr, &st);
+	}
 
 	if (not_vcf && bm->n_aal > 0) {
 		if (bm->flag & BGT_F_CNT_HAP) {
@@ -174,6 +419,8 @@ int main_view(int argc, char *argv[])
 	}
 
 	if (out) hts_close(out);
+	if (plink) plink_close(plink);
+	if (bgtw) bgtw_close(bgtw);
 	bgtm_reader_destroy(bm);
 	if (bed) bed_destroy(bed);
 	for (i = 0; i < n_files; ++i) bgt_close(files[i]);
@@ -226,3 +473,37 @@ int main_getalt(int argc, char *argv[])
 	free(s.s);
 	return 0;
 }
+
+int main_annidx(int argc, char *argv[])
+{
+	int i;
+	if (argc < 3) {
+		fprintf(stderr, "Usage: bgt annidx <anno.fmf> <bgt-prefix> [...]\n");
+		fprintf(stderr, "Note: for each BGT, map rows of <anno.fmf> to sites and write the join index to <bgt-prefix>.jdx\n");
+		return 1;
+	}
+	for (i = 2; i < argc; ++i) {
+		if (bgt_jdx_build(argv[i], argv[1]) < 0) {
+			fprintf(stderr, "[E::%s] failed to build the join index for BGT '%s'\n", __func__, argv[i]);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+int main_smpidx(int argc, char *argv[])
+{
+	int i;
+	if (argc < 2) {
+		fprintf(stderr, "Usage: bgt smpidx <bgt-prefix> [...]\n");
+		fprintf(stderr, "Note: for each BGT, list rows where each sample has an ALT allele and write the index to <bgt-prefix>.sdx\n");
+		return 1;
+	}
+	for (i = 1; i < argc; ++i) {
+		if (bgt_sdx_build(argv[i]) < 0) {
+			fprintf(stderr, "[E::%s] failed to build the sample index for BGT '%s'\n", __func__, argv[i]);
+			return 1;
+		}
+	}
+	return 0;
+}